@@ -4,7 +4,7 @@
 #include "algorithm.h"
 
 // 定义列之间的算术运算函数
-VectorXd Algorithm::column_operate(const MatrixXd& matrix, int col1, int col2, std::string op) {
+VectorXd Algorithm::column_operate(const Ref<const MatrixXd>& matrix, int col1, int col2, std::string op) {
     if (op == "add") {
         return matrix.col(col1) + matrix.col(col2);
     } else if (op == "subtract") {
@@ -25,7 +25,7 @@ VectorXd Algorithm::column_operate(const MatrixXd& matrix, int col1, int col2, s
  * @param y 
  * @return correlation coefficient 
  */
-double Algorithm::calculatePearsonCorrelation(const VectorXd& x, const VectorXd& y) {
+double Algorithm::calculatePearsonCorrelation(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y) {
     // The size of x and y must be the same.
     assert(x.size() == y.size());
     double mean_x = x.mean();
@@ -37,9 +37,22 @@ double Algorithm::calculatePearsonCorrelation(const VectorXd& x, const VectorXd&
     return pearson_corr;
 }
 
-double Algorithm::calculatePearsonCorrelationWithNaN(const VectorXd& x, const VectorXd& y) {
+double Algorithm::calculatePearsonCorrelationWithNaN(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y) {
     assert(x.size() == y.size());
+    double sums[PEARSON_SUMS] = {0};
+    pearsonSums(x, y, sums);
+    return pearsonFromSums(sums);
+}
 
+/**
+ * @brief Add the sufficient statistics of the Pearson correlation of the complete
+ *        observations of x and y to `sums` (count, sum x, sum y, sum x^2, sum y^2, sum xy)
+ * 
+ * @param x
+ * @param y
+ * @param sums
+ */
+void Algorithm::pearsonSums(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y, double* sums) {
     double sumX = 0, sumY = 0;
     double sumXSq = 0, sumYSq = 0;
     double sumXY = 0;
@@ -54,16 +67,31 @@ double Algorithm::calculatePearsonCorrelationWithNaN(const VectorXd& x, const Ve
         sumXY += x[i] * y[i];
         count++;
     }
+    sums[0] += count;
+    sums[1] += sumX;
+    sums[2] += sumY;
+    sums[3] += sumXSq;
+    sums[4] += sumYSq;
+    sums[5] += sumXY;
+}
 
+/**
+ * @brief Pearson correlation from its sufficient statistics
+ * 
+ * @param sums count, sum x, sum y, sum x^2, sum y^2, sum xy
+ * @return correlation coefficient, NaN for less than 2 observations or a constant vector
+ */
+double Algorithm::pearsonFromSums(const double* sums) {
+    double count = sums[0];
     if (count < 2) {
         return std::numeric_limits<double>::quiet_NaN();
     }
 
-    double meanX = sumX / count;
-    double meanY = sumY / count;
-    double covariance = (sumXY / count - meanX * meanY);
-    double varianceX = (sumXSq / count - meanX * meanX);
-    double varianceY = (sumYSq / count - meanY * meanY);
+    double meanX = sums[1] / count;
+    double meanY = sums[2] / count;
+    double covariance = (sums[5] / count - meanX * meanY);
+    double varianceX = (sums[3] / count - meanX * meanX);
+    double varianceY = (sums[4] / count - meanY * meanY);
 
     if (varianceX == 0 || varianceY == 0) {
         return std::numeric_limits<double>::quiet_NaN(); // Avoid division by zero
@@ -72,7 +100,7 @@ double Algorithm::calculatePearsonCorrelationWithNaN(const VectorXd& x, const Ve
     return covariance / (std::sqrt(varianceX) * std::sqrt(varianceY));
 }
 
-double Algorithm::calculatePearsonCorrelationVectorized(const Eigen::VectorXd& x, const Eigen::VectorXd& y) {
+double Algorithm::calculatePearsonCorrelationVectorized(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y) {
     assert(x.size() == y.size());
 
     // 计算有效元素的数量
@@ -111,20 +139,24 @@ double Algorithm::calculatePearsonCorrelationVectorized(const Eigen::VectorXd& x
  * @param y 
  * @return correlation coefficient 
  */
-double Algorithm::calculateSpearmanCorrelation(const VectorXd& x, const VectorXd& y) {
-    VectorXd rank_x = x;
-    VectorXd rank_y = y;
-    // Calculate ranks
+double Algorithm::calculateSpearmanCorrelation(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y) {
+    return calculatePearsonCorrelation(rank(x), rank(y));
+}
+
+/**
+ * @brief Rank of each element (0 for the smallest), ties keep an arbitrary order
+ * 
+ * @param x
+ * @return ranks 
+ */
+VectorXd Algorithm::rank(const Ref<const VectorXd>& x) {
+    VectorXd ranks(x.size());
     std::vector<int> index(x.size());
     std::iota(index.begin(), index.end(), 0);
     std::sort(index.begin(), index.end(), [&](int i, int j) { return x(i) < x(j); });
     for (int i = 0; i < x.size(); ++i)
-        rank_x(index[i]) = i;
-    std::iota(index.begin(), index.end(), 0);
-    std::sort(index.begin(), index.end(), [&](int i, int j) { return y(i) < y(j); });
-    for (int i = 0; i < y.size(); ++i)
-        rank_y(index[i]) = i;
-    return calculatePearsonCorrelation(rank_x, rank_y);
+        ranks(index[i]) = i;
+    return ranks;
 }
 
 /**
@@ -134,7 +166,7 @@ double Algorithm::calculateSpearmanCorrelation(const VectorXd& x, const VectorXd
  * @param y vector
  * @return correlation coefficient 
 */
-double Algorithm::calculateKendallCorrelation(const VectorXd& x, const VectorXd& y) {
+double Algorithm::calculateKendallCorrelation(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y) {
     int n = x.size();
     int P = 0, Q = 0;
 
@@ -149,4 +181,135 @@ double Algorithm::calculateKendallCorrelation(const VectorXd& x, const VectorXd&
     }
 
     return static_cast<double>(P - Q) / static_cast<double>(n * (n - 1) / 2);
+}
+
+/**
+ * @brief Dot product of two columns of a sparse matrix, a merge of their non-zero rows
+ * 
+ * @param m compressed sparse matrix
+ * @param a
+ * @param b
+ * @return double 
+ */
+double Algorithm::sparseDot(const SparseMatrix<double>& m, int a, int b) {
+    const int* rows = m.innerIndexPtr();
+    const double* values = m.valuePtr();
+    int p = m.outerIndexPtr()[a], pe = m.outerIndexPtr()[a + 1];
+    int q = m.outerIndexPtr()[b], qe = m.outerIndexPtr()[b + 1];
+    double dot = 0;
+    while (p < pe && q < qe) {
+        if (rows[p] < rows[q]) {
+            ++p;
+        } else if (rows[q] < rows[p]) {
+            ++q;
+        } else {
+            dot += values[p++] * values[q++];
+        }
+    }
+    return dot;
+}
+
+/**
+ * @brief Dot product of a column of a sparse matrix with a dense vector
+ * 
+ * @param m compressed sparse matrix
+ * @param a
+ * @param y
+ * @return double 
+ */
+double Algorithm::sparseDot(const SparseMatrix<double>& m, int a, const Ref<const VectorXd>& y) {
+    const int* rows = m.innerIndexPtr();
+    const double* values = m.valuePtr();
+    double dot = 0;
+    for (int p = m.outerIndexPtr()[a]; p < m.outerIndexPtr()[a + 1]; ++p)
+        dot += values[p] * y[rows[p]];
+    return dot;
+}
+
+/**
+ * @brief Number of rows with m(r, a) > m(r, b), rows where both are zero are skipped
+ * 
+ * @param m compressed sparse matrix
+ * @param a
+ * @param b
+ * @return int 
+ */
+int Algorithm::sparseGreater(const SparseMatrix<double>& m, int a, int b) {
+    const int* rows = m.innerIndexPtr();
+    const double* values = m.valuePtr();
+    int p = m.outerIndexPtr()[a], pe = m.outerIndexPtr()[a + 1];
+    int q = m.outerIndexPtr()[b], qe = m.outerIndexPtr()[b + 1];
+    int count = 0;
+    while (p < pe || q < qe) {
+        if (q == qe || (p < pe && rows[p] < rows[q])) {
+            count += values[p++] > 0;
+        } else if (p == pe || rows[q] < rows[p]) {
+            count += 0 > values[q++];
+        } else {
+            count += values[p++] > values[q++];
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Add the pearson sums of x = m(:, a) + sign * m(:, b) and y to `sums`, only the non-zero
+ *        rows of x are read, the other rows only add to the sums of y given in `ysums`
+ * 
+ * @param m compressed sparse matrix
+ * @param a
+ * @param b second column, -1 for x = m(:, a)
+ * @param sign 1 to add the second column, -1 to subtract it
+ * @param y dense vector, NaN values are left out
+ * @param ysums count, sum y and sum y^2 of the values of y that are not NaN
+ * @param sums
+ */
+void Algorithm::sparseSums(const SparseMatrix<double>& m, int a, int b, double sign, const Ref<const VectorXd>& y,
+                           const double* ysums, double* sums) {
+    const int* rows = m.innerIndexPtr();
+    const double* values = m.valuePtr();
+    int p = m.outerIndexPtr()[a], pe = m.outerIndexPtr()[a + 1];
+    int q = b < 0 ? 0 : m.outerIndexPtr()[b], qe = b < 0 ? 0 : m.outerIndexPtr()[b + 1];
+    double sumX = 0, sumXSq = 0, sumXY = 0;
+    while (p < pe || q < qe) {
+        int row;
+        double x;
+        if (q == qe || (p < pe && rows[p] < rows[q])) {
+            row = rows[p];
+            x = values[p++];
+        } else if (p == pe || rows[q] < rows[p]) {
+            row = rows[q];
+            x = sign * values[q++];
+        } else {
+            row = rows[p];
+            x = values[p++] + sign * values[q++];
+        }
+        if (std::isnan(y[row])) continue;
+        sumX += x;
+        sumXSq += x * x;
+        sumXY += x * y[row];
+    }
+    sums[0] += ysums[0];
+    sums[1] += sumX;
+    sums[2] += ysums[1];
+    sums[3] += sumXSq;
+    sums[4] += ysums[2];
+    sums[5] += sumXY;
+}
+
+/**
+ * @brief Correlation function of a method
+ * 
+ * @param method pearson/spearman/kendall
+ * @return CorrFunc 
+ */
+CorrFunc Algorithm::getCorrelation(const std::string& method) {
+    if (method == "pearson") {
+        return &calculatePearsonCorrelationWithNaN;
+    } else if (method == "spearman") {
+        return &calculateSpearmanCorrelation;
+    } else if (method == "kendall") {
+        return &calculateKendallCorrelation;
+    }
+    throw std::invalid_argument("Invalid method." + method);
 }
\ No newline at end of file
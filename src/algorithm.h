@@ -6,8 +6,10 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <functional>
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 
 #include "utils.h"
 #include "dataframe.h"
@@ -17,16 +19,32 @@ using namespace std;
 using namespace Eigen;
 
 typedef tuple<string, string, double> GenePair;
+typedef std::function<double(const Ref<const VectorXd>&, const Ref<const VectorXd>&)> CorrFunc;
 
 namespace Algorithm {
 
-    // functions
-    double calculatePearsonCorrelation(const VectorXd& x, const VectorXd& y);
-    double calculatePearsonCorrelationWithNaN(const VectorXd& x, const VectorXd& y);
-    double calculatePearsonCorrelationVectorized(const VectorXd& x, const VectorXd& y);
-    double calculateSpearmanCorrelation(const VectorXd& x, const VectorXd& y);
-    double calculateKendallCorrelation(const VectorXd& x, const VectorXd& y);
+    const int PEARSON_SUMS = 6;  // count, sum x, sum y, sum x^2, sum y^2, sum xy
 
-    VectorXd column_operate(const MatrixXd& matrix, int col1, int col2, std::string op);
+    // functions
+    double calculatePearsonCorrelation(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y);
+    double calculatePearsonCorrelationWithNaN(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y);
+    double calculatePearsonCorrelationVectorized(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y);
+    double calculateSpearmanCorrelation(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y);
+    double calculateKendallCorrelation(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y);
+    CorrFunc getCorrelation(const std::string& method);
+
+    void pearsonSums(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y, double* sums);
+    double pearsonFromSums(const double* sums);
+
+    VectorXd rank(const Ref<const VectorXd>& x);
+
+    // columns of a compressed sparse matrix, the zeros that are not stored take part
+    double sparseDot(const SparseMatrix<double>& m, int a, int b);
+    double sparseDot(const SparseMatrix<double>& m, int a, const Ref<const VectorXd>& y);
+    int sparseGreater(const SparseMatrix<double>& m, int a, int b);
+    void sparseSums(const SparseMatrix<double>& m, int a, int b, double sign, const Ref<const VectorXd>& y,
+                    const double* ysums, double* sums);
+
+    VectorXd column_operate(const Ref<const MatrixXd>& matrix, int col1, int col2, std::string op);
 }
 #endif
\ No newline at end of file
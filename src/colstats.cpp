@@ -0,0 +1,102 @@
+#include <cmath>
+#include <fstream>
+
+#include "utils.h"
+#include "algorithm.h"
+#include "colstats.h"
+
+namespace {
+    const char MAGIC[4] = {'G', 'P', 'C', 'S'};
+    // version 1 has the count and mean of every column, which no kernel reads
+    const uint32_t VERSION = 2;
+}
+
+ColumnStats::ColumnStats() {}
+
+/**
+ * @brief Summarize every column, in parallel over the columns
+ *
+ * @param data
+ * @param useRanks standardize the ranks of the columns (spearman)
+ * @param threads
+ */
+void ColumnStats::compute(const Ref<const MatrixXd>& data, bool useRanks, size_t threads) {
+    ranks = useRanks;
+    Index cols = data.cols();
+    norm.setZero(cols);
+    missing.assign(cols, 0);
+    z.setZero(data.rows(), cols);
+    #pragma omp parallel for schedule(static) num_threads(std::max<size_t>(threads, 1))
+    for (Index c = 0; c < cols; ++c) {
+        if (data.col(c).array().isNaN().any()) {
+            missing[c] = 1;
+            continue;
+        }
+        VectorXd x = ranks ? Algorithm::rank(data.col(c)) : VectorXd(data.col(c));
+        x.array() -= x.mean();
+        norm[c] = x.norm();
+        if (norm[c] > 0)
+            z.col(c) = x / norm[c];
+    }
+}
+
+/**
+ * @brief Save the statistics to file
+ *
+ * @param filename
+ * @return true
+ * @return false
+ */
+bool ColumnStats::save(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[Column Stats] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    file.write(MAGIC, sizeof(MAGIC));
+    Utils::writeValue<uint32_t>(file, VERSION);
+    Utils::writeValue<uint32_t>(file, ranks ? 1 : 0);
+    Utils::writeValue<uint64_t>(file, z.rows());
+    Utils::writeValue<uint64_t>(file, z.cols());
+    file.write(reinterpret_cast<const char*>(norm.data()), norm.size() * sizeof(double));
+    file.write(missing.data(), missing.size());
+    file.write(reinterpret_cast<const char*>(z.data()), z.size() * sizeof(double));
+    return static_cast<bool>(file);
+}
+
+/**
+ * @brief Load the statistics from file
+ *
+ * @param filename
+ * @return true
+ * @return false
+ */
+bool ColumnStats::load(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4];
+    uint32_t version, flag;
+    uint64_t rows, cols;
+    if (!file.is_open() || !file.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, MAGIC) ||
+        !Utils::readValue(file, version) || (version != 1 && version != VERSION) || !Utils::readValue(file, flag) ||
+        !Utils::readValue(file, rows) || !Utils::readValue(file, cols)) {
+        std::cerr << "[Column Stats] - Invalid statistics file: " << filename << std::endl;
+        return false;
+    }
+    // a damaged size is rejected instead of allocated
+    uint64_t left = Utils::remaining(file);
+    uint64_t columnBytes = (version == 1 ? 3 : 1) * sizeof(double) + 1;
+    if (cols > left / columnBytes || (cols > 0 && rows > (left - cols * columnBytes) / cols / sizeof(double))) {
+        std::cerr << "[Column Stats] - Invalid statistics file: " << filename << std::endl;
+        return false;
+    }
+    ranks = flag == 1;
+    norm.resize(cols);
+    missing.resize(cols);
+    z.resize(rows, cols);
+    if (version == 1)
+        file.seekg(2 * cols * sizeof(double), std::ios::cur);
+    file.read(reinterpret_cast<char*>(norm.data()), norm.size() * sizeof(double));
+    file.read(missing.data(), missing.size());
+    file.read(reinterpret_cast<char*>(z.data()), z.size() * sizeof(double));
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,40 @@
+#ifndef COLSTATS_H
+#define COLSTATS_H
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+/**
+ * Statistics of every column of a matrix, computed once in parallel. Columns without
+ * NaN are centered and scaled to unit norm in `z` (the ranks for spearman), so that
+ * the pearson correlation of two such columns is the dot product of their `z`.
+ *
+ * File layout (native byte order):
+ *   magic "GPCS", u32 version, u32 ranks, u64 rows, u64 cols,
+ *   norm (cols f64), missing (cols u8), z (rows * cols f64)
+ * Version 1 files also have the count and mean of every column before norm, they are skipped.
+ */
+class ColumnStats {
+public:
+    VectorXd norm;               // norm of the centered values
+    std::vector<char> missing;   // the column contains NaN
+    MatrixXd z;                  // standardized columns, zero for columns with NaN
+    bool ranks = false;          // z holds the standardized ranks
+
+    ColumnStats();
+
+    void compute(const Ref<const MatrixXd>& data, bool ranks, size_t threads);
+    size_t size() const { return missing.size(); }
+    bool empty() const { return missing.empty(); }
+    // the column has a standardized copy, otherwise its correlations need the raw values
+    bool complete(Index c) const { return !missing[c]; }
+
+    bool save(const std::string& filename) const;
+    bool load(const std::string& filename);
+};
+
+#endif
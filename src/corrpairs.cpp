@@ -1,43 +1,144 @@
+#include <map>
+#include <limits>
+#include <numeric>
+#include <array>
+#include <random>
+#include <fstream>
+#include <cstdlib>
+
 #include "corrpairs.h"
 
+namespace {
+    // paths kept in a run directory are resolved against the working directory of the run
+    std::string absolute(const std::string& path) {
+        if (path.empty() || path[0] == '/') return path;
+        return Utils::joinpath(Utils::cwd(), path);
+    }
+
+    // whether two paths name the same file, following links when it exists
+    bool samePath(const std::string& path, const std::string& other) {
+        if (Utils::exists(path) && Utils::exists(other))
+            return Utils::abspath(path) == Utils::abspath(other);
+        return absolute(path) == absolute(other);
+    }
+}
+
 /**
  * @brief Construct a new Corr Pairs:: Corr Pairs object
  * 
  */
-CorrPairs::CorrPairs() {
-    options = new CorrOptions();
+CorrPairs::CorrPairs() {}
+
+/**
+ * @brief Construct a new Corr Pairs:: Corr Pairs object from the files of the options
+ * 
+ * @param opts
+ */
+CorrPairs::CorrPairs(const CorrOptions& opts) : options(opts) {
+    {
+        Metrics::Phase phase("load");
+        if (!options.appendTargets.empty()) {
+            if (!loadRun()) {
+                throw std::invalid_argument("Invalid run directory: " + options.runDir);
+            }
+            return;
+        }
+        if (options.memoryLimit > 0) {
+            source = mapData(options.expression, options.memoryLimit << 20, options.cacheDir);
+            if (source == nullptr) {
+                throw std::invalid_argument("Failed to map the data file: " + options.expression);
+            }
+        } else {
+            source = new DataFrame(options.expression);
+        }
+        if (Utils::exists(options.target)) {
+            target = new DataFrame(options.target);
+        }
+    }
+    setup();
 }
 
 /**
- * @brief Construct a new Corr Pairs:: Corr Pairs object
+ * @brief Construct a new Corr Pairs:: Corr Pairs object over data frames loaded by the caller,
+ *        which keeps them and may share them between runs
  * 
- * @param opts 
+ * @param opts
+ * @param sourceFrame
+ * @param targetFrame nullptr without target data
  */
-CorrPairs::CorrPairs(CorrOptions *opts) {
-    options = opts;
-    source = new DataFrame(options->expression);
-    if (Utils::exists(options->target))
-        target = new DataFrame(options->target);
-    // correlation algorithm
-    if (options->method == "pearson") {
-        func = &Algorithm::calculatePearsonCorrelationWithNaN;
-    } else if (options->method == "spearman") {
-        func = &Algorithm::calculateSpearmanCorrelation;
-    } else if (options->method == "kendall") {
-        func = &Algorithm::calculateKendallCorrelation;
-    } else {
-        throw std::invalid_argument("Invalid method." + options->method);
+CorrPairs::CorrPairs(const CorrOptions& opts, DataFrame* sourceFrame, DataFrame* targetFrame) : options(opts) {
+    if (!options.covariates.empty() || !options.appendTargets.empty() || options.memoryLimit > 0) {
+        throw std::invalid_argument("Covariates, run directories and --memory-limit need data loaded for the run alone.");
     }
-    // block size for thread
-    if (options->block < 10) {
-        options->block = source->data.cols();
+    source = sourceFrame;
+    target = targetFrame;
+    ownsData = false;
+    setup();
+}
+
+/**
+ * @brief Views, feature names and selections of the loaded data
+ * 
+ */
+void CorrPairs::setup() {
+    Metrics::Phase phase("preprocess");
+    if (source->is_sparse() && !sparseKernels()) {
+        std::cout << "[Correlation Pairs] - Sparse kernels only compute pearson correlations (add/subtract in pairs mode), the data is converted to dense." << std::endl;
+        source->densify();
+    }
+    new (&sdata) Map<const MatrixXd>(source->view());
+    columns = source->columns;
+    prepareSparse();
+    if (target != nullptr) {
+        target->densify();
+        new (&tdata) Map<const MatrixXd>(target->data.data(), target->data.rows(), target->data.cols());
+        targetColumns = target->columns;
+    }
+    if (!options.covariates.empty()) {
+        if (!adjustCovariates(source) || (target != nullptr && !adjustCovariates(target))) {
+            throw std::invalid_argument("Invalid covariate file: " + options.covariates);
+        }
+        ssparse = nullptr;
+        new (&sdata) Map<const MatrixXd>(source->view());
+        if (target != nullptr)
+            new (&tdata) Map<const MatrixXd>(target->data.data(), target->data.rows(), target->data.cols());
+    }
+    init();
+    if (!options.features.empty() && !setFeatures(Utils::readList(options.features))) {
+        throw std::invalid_argument("Invalid feature list: " + options.features);
+    }
+    if (!options.targets.empty() && !setTargets(Utils::readList(options.targets))) {
+        throw std::invalid_argument("Invalid target list: " + options.targets);
     }
     // output filename
-    if (options->output.empty()) {
-        options->output = Utils::dirname(options->expression) + "/output.txt";
+    if (options.output.empty()) {
+        options.output = Utils::dirname(options.expression) + "/output.txt";
     }
+}
 
-    threshold = static_cast<int>(options->threshold * 1000);
+/**
+ * @brief Construct a new Corr Pairs:: Corr Pairs object over an in-memory matrix (samples x features),
+ *        the data is not copied
+ * 
+ * @param opts
+ * @param sourceData
+ */
+CorrPairs::CorrPairs(const CorrOptions& opts, const Map<const MatrixXd>& sourceData) : options(opts) {
+    new (&sdata) Map<const MatrixXd>(sourceData);
+    init();
+}
+
+/**
+ * @brief Construct a new Corr Pairs:: Corr Pairs object over in-memory source and target matrices
+ * 
+ * @param opts
+ * @param sourceData
+ * @param targetData
+ */
+CorrPairs::CorrPairs(const CorrOptions& opts, const Map<const MatrixXd>& sourceData, const Map<const MatrixXd>& targetData) : options(opts) {
+    new (&sdata) Map<const MatrixXd>(sourceData);
+    new (&tdata) Map<const MatrixXd>(targetData);
+    init();
 }
 
 /**
@@ -45,10 +146,7 @@ CorrPairs::CorrPairs(CorrOptions *opts) {
  * 
  */
 CorrPairs::~CorrPairs() {
-    if (options != nullptr) {
-        delete options;
-        options = nullptr;
-    }
+    if (!ownsData) return;
     if (source != nullptr) {
         delete source;
         source = nullptr;
@@ -59,36 +157,732 @@ CorrPairs::~CorrPairs() {
     }
 }
 
+/**
+ * @brief Correlation algorithm and defaults depending on the data
+ * 
+ */
+void CorrPairs::init() {
+    // correlation algorithm
+    func = Algorithm::getCorrelation(options.method);
+    // block size for thread
+    if (options.block < 10) {
+        options.block = sourceCols();
+    }
+    // feature names
+    if (columns.size() != static_cast<size_t>(sourceCols())) {
+        columns.resize(sourceCols());
+        for (size_t i = 0; i < columns.size(); ++i)
+            columns[i] = std::to_string(i);
+    }
+    if (targetColumns.size() != static_cast<size_t>(tdata.cols())) {
+        targetColumns.resize(tdata.cols());
+        for (size_t i = 0; i < targetColumns.size(); ++i)
+            targetColumns[i] = std::to_string(i);
+    }
+    // all features are selected by default
+    if (selected.size() != static_cast<size_t>(sourceCols())) {
+        featureIndex.resize(sourceCols());
+        std::iota(featureIndex.begin(), featureIndex.end(), 0);
+        selected.assign(sourceCols(), 1);
+    }
+    if (targetIndex.empty()) {
+        targetIndex.resize(tdata.cols());
+        std::iota(targetIndex.begin(), targetIndex.end(), 0);
+    }
+
+    threshold = static_cast<int>(options.threshold * 1000);
+}
+
+/**
+ * @brief Regress the covariates out of the source or the target data, the correlations of the
+ *        residuals are partial correlations
+ * 
+ * @param data 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::adjustCovariates(DataFrame* data) {
+    if (options.method != "pearson") {
+        std::cerr << "[Correlation Pairs] - Covariates are only available for pearson correlations." << std::endl;
+        return false;
+    }
+    if (options.analysis == "pairs" && !linearOperations()) {
+        std::cerr << "[Correlation Pairs] - Covariates are only available for add/subtract in pairs mode." << std::endl;
+        return false;
+    }
+    if (!options.stats.empty() || data->is_mapped()) {
+        std::cerr << "[Correlation Pairs] - Covariates need the data in memory and can't be combined with --save-stats." << std::endl;
+        return false;
+    }
+    Covariates cov;
+    if (!cov.load(options.covariates, data->index)) {
+        return false;
+    }
+    // residuals are dense
+    data->densify();
+    cov.residualize(data->data, options.threads);
+    std::cout << "[Correlation Pairs] - Regressed " << cov.size() << " covariates out of the data." << std::endl;
+    return true;
+}
+
+/**
+ * @brief Restore a finished cross/pairs run from its directory and only keep the target
+ *        features that were not computed yet
+ * 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::loadRun() {
+    std::string dir = options.runDir;
+    InputStream runFile(dir + "/run.txt");
+    if (!runFile.is_open()) {
+        std::cerr << "[Correlation Pairs] - Failed to open file: " << dir << "/run.txt" << std::endl;
+        return false;
+    }
+    std::map<std::string, std::string> run;
+    std::vector<std::string> fields;
+    std::string line;
+    while (std::getline(runFile, line)) {
+        Utils::split(Utils::rstrip(line, "\n\r"), fields, "\t");
+        if (fields.size() == 2)
+            run[fields[0]] = fields[1];
+    }
+    // a run file cut short or edited by hand
+    const std::string& threshold = run["threshold"];
+    char* end = nullptr;
+    options.threshold = std::strtod(threshold.c_str(), &end);
+    if ((run["analysis"] != "cross" && run["analysis"] != "pairs") || run["method"].empty() ||
+        threshold.empty() || *end != '\0') {
+        std::cerr << "[Correlation Pairs] - The run file " << dir << "/run.txt is missing or damaged." << std::endl;
+        return false;
+    }
+    options.analysis = run["analysis"];
+    options.method = run["method"];
+    options.operation = run["operation"];
+    options.features = run["features"];
+    options.covariates = run["covariates"];
+    // results are appended to the output of the run unless another output is given
+    appendOutput = options.output.empty() || (!run["output"].empty() && samePath(options.output, run["output"]));
+    if (options.output.empty())
+        options.output = run["output"];
+    if (options.output.empty()) {
+        std::cerr << "[Correlation Pairs] - The run only wrote a summary, give an output with -o." << std::endl;
+        return false;
+    }
+
+    source = new DataFrame();
+    bool loaded = options.memoryLimit > 0 ? source->map_binary(dir + "/source.gpm") : source->read_binary(dir + "/source.gpm");
+    if (!loaded) {
+        return false;
+    }
+    new (&sdata) Map<const MatrixXd>(source->view());
+    columns = source->columns;
+    if (Utils::exists(dir + "/source.stats") && !sourceStats.load(dir + "/source.stats")) {
+        return false;
+    }
+    if (!sourceStats.empty() && (sourceStats.z.rows() != sdata.rows() || static_cast<Index>(sourceStats.size()) != sdata.cols())) {
+        std::cerr << "[Correlation Pairs] - The statistics " << dir << "/source.stats do not match the source data of the run." << std::endl;
+        return false;
+    }
+    target = new DataFrame(options.appendTargets);
+    target->densify();
+    new (&tdata) Map<const MatrixXd>(target->data.data(), target->data.rows(), target->data.cols());
+    targetColumns = target->columns;
+    // the source data of the run is already adjusted, only the new targets are
+    if (!options.covariates.empty()) {
+        if (!adjustCovariates(target)) return false;
+        new (&tdata) Map<const MatrixXd>(target->data.data(), target->data.rows(), target->data.cols());
+    }
+    init();
+    if (!options.features.empty() && !setFeatures(Utils::readList(options.features))) {
+        return false;
+    }
+
+    std::vector<std::string> done = Utils::readList(dir + "/targets.txt");
+    std::sort(done.begin(), done.end());
+    std::vector<std::string> names;
+    for (const auto& name : targetColumns)
+        if (!std::binary_search(done.begin(), done.end(), name)) names.push_back(name);
+    if (names.size() < targetColumns.size())
+        std::cout << "[Correlation Pairs] - Skip " << targetColumns.size() - names.size() << " target features of the previous runs." << std::endl;
+    if (names.empty()) {
+        std::cout << "[Correlation Pairs] - All target features were computed by the previous runs, nothing to append." << std::endl;
+        complete = true;
+        return true;
+    }
+    return setTargets(names);
+}
+
+/**
+ * @brief Keep the source data and its standardized columns in the run directory,
+ *        so that new target features can be appended without reading the source again
+ * 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::saveRun() {
+    std::string dir = options.runDir;
+    bool created = options.appendTargets.empty();
+    if (created) {
+        if (options.analysis != "cross" && options.analysis != "pairs") {
+            std::cerr << "[Correlation Pairs] - A run directory is only kept for cross and pairs analyses." << std::endl;
+            return false;
+        }
+        if (source == nullptr || !Utils::makedir(dir) || !source->to_binary(dir + "/source.gpm")) {
+            std::cerr << "[Correlation Pairs] - Failed to write the run directory " << dir << std::endl;
+            return false;
+        }
+        if (!sourceStats.empty() && !sourceStats.save(dir + "/source.stats")) {
+            return false;
+        }
+        std::ofstream runFile(dir + "/run.txt");
+        runFile << "analysis\t" << options.analysis << "\n";
+        runFile << "method\t" << options.method << "\n";
+        runFile << "operation\t" << options.operation << "\n";
+        runFile << "threshold\t" << options.threshold << "\n";
+        runFile << "features\t" << absolute(options.features) << "\n";
+        runFile << "covariates\t" << absolute(options.covariates) << "\n";
+        // a summary has no pairs to append to
+        runFile << "output\t" << (options.summary ? "" : absolute(options.output)) << "\n";
+        if (!runFile) {
+            std::cerr << "[Correlation Pairs] - Failed to write the run directory " << dir << std::endl;
+            return false;
+        }
+    }
+    // target features of this run
+    std::ofstream targetFile(dir + "/targets.txt", created ? std::ios::trunc : std::ios::app);
+    for (int k : targetIndex)
+        targetFile << targetColumns[k] << "\n";
+    if (!targetFile) {
+        std::cerr << "[Correlation Pairs] - Failed to write the run directory " << dir << std::endl;
+        return false;
+    }
+    std::cout << "[Correlation Pairs] - The run is kept in " << dir << std::endl;
+    return true;
+}
+
+/**
+ * @brief Deliver pairs to the sink every `batch` pairs instead of keeping them in `pairs`
+ * 
+ * @param callback called by one thread at a time, from inside the parallel region: an exception
+ *                 it throws can't be caught there and terminates the process
+ * @param batch
+ */
+void CorrPairs::setSink(PairSink callback, size_t batch) {
+    sink = callback;
+    batchSize = std::max<size_t>(batch, 1);
+}
+
+/**
+ * @brief Only find the pairs whose first feature is selected, the partner ranges over all features
+ * 
+ * @param names selected source feature names
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::setFeatures(const std::vector<std::string>& names) {
+    int missing;
+    std::vector<int> index = Utils::indexOf(columns, names, missing);
+    if (missing > 0)
+        std::cout << "[Correlation Pairs] - Skip " << missing << " selected features that are not in the expression file." << std::endl;
+    if (index.empty()) {
+        std::cerr << "[Correlation Pairs] - None of the selected features is in the expression file." << std::endl;
+        return false;
+    }
+    featureIndex.swap(index);
+    selected.assign(sourceCols(), 0);
+    for (int i : featureIndex)
+        selected[i] = 1;
+    std::cout << "[Correlation Pairs] - Search the pairs of " << featureIndex.size() << " selected features." << std::endl;
+    return true;
+}
+
+/**
+ * @brief Only use some target features
+ * 
+ * @param names selected target feature names
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::setTargets(const std::vector<std::string>& names) {
+    int missing;
+    std::vector<int> index = Utils::indexOf(targetColumns, names, missing);
+    if (missing > 0)
+        std::cout << "[Correlation Pairs] - Skip " << missing << " selected targets that are not in the target file." << std::endl;
+    if (index.empty()) {
+        std::cerr << "[Correlation Pairs] - None of the selected targets is in the target file." << std::endl;
+        return false;
+    }
+    targetIndex.swap(index);
+    std::cout << "[Correlation Pairs] - Use " << targetIndex.size() << " selected target features." << std::endl;
+    return true;
+}
+
+/**
+ * @brief Source data read by the calling thread, the copy of its NUMA node if replicated
+ * 
+ * @return Map<const MatrixXd> 
+ */
+Map<const MatrixXd> CorrPairs::sourceView() const {
+    return numa.sourceView(sdata);
+}
+
+/**
+ * @brief Target data read by the calling thread, the copy of its NUMA node if replicated
+ * 
+ * @return Map<const MatrixXd> 
+ */
+Map<const MatrixXd> CorrPairs::targetView() const {
+    return numa.targetView(tdata);
+}
+
+/**
+ * @brief Copies of standardized columns on every NUMA node, when the data is replicated
+ * 
+ * @param z
+ * @return one matrix per node, empty without replicas
+ */
+std::vector<MatrixXd> CorrPairs::replicate(const MatrixXd& z) const {
+    if (!numa.placed() || z.size() == 0) return std::vector<MatrixXd>();
+    return numa.replicate(z);
+}
+
+/**
+ * @brief Columns of the source blocks streamed through memory, all columns for data in memory
+ * 
+ * @return int 
+ */
+int CorrPairs::blockWidth() const {
+    if (!outOfCore()) return sourceCols();
+    return tileWidth(options.memoryLimit << 20, sdata.rows() * sizeof(double), sdata.cols());
+}
+
+/**
+ * @brief Hand the pairs found by a thread over to the sink or to `pairs`
+ * 
+ * @param local pairs of the calling thread
+ * @param final end of the thread's work
+ */
+void CorrPairs::collect(PairStore& local, bool final) {
+    if (options.summary) {
+        // each thread folds its own pairs, without waiting for the others
+        if (local.size() == 0 || (!final && local.size() < Summary::BATCH)) return;
+        summary.add(local, omp_get_thread_num());
+    } else if (sink) {
+        if (local.size() == 0 || (!final && local.size() < batchSize)) return;
+        #pragma omp critical(collect)
+        sink(local);
+    } else {
+        if (!final) return;
+        order.keep(omp_get_thread_num(), local);
+    }
+    local.clear();
+}
+
+/**
+ * @brief Note the position of the next pair of the calling thread in the loop of a tile
+ * 
+ * @param tile
+ * @param iteration iteration of the collapsed loop of the tile
+ * @param local pairs of the calling thread
+ */
+void CorrPairs::mark(size_t tile, uint64_t iteration, const PairStore& local) {
+    if (!sink && !options.summary)
+        order.mark(omp_get_thread_num(), tile, iteration, local.size());
+}
+
+/**
+ * @brief Prepare the sufficient statistics of the candidate pairs
+ * 
+ * @param mode common, cross or pairs
+ * @param nkeys
+ */
+void CorrPairs::trackStats(const std::string& mode, size_t nkeys) {
+    stats.reset(nkeys, Algorithm::PEARSON_SUMS);
+    stats.mode = mode;
+    stats.operation = options.operation;
+    stats.threshold = options.threshold;
+    stats.slack = options.slack;
+    stats.srows = sourceRows();
+    stats.trows = tdata.size() > 0 ? sourceRows() : 0;
+    // an update skips the samples given again
+    stats.sourceSamples = source != nullptr ? source->index : std::vector<std::string>();
+    candidate = static_cast<int>((options.threshold - options.slack) * 1000);
+}
+
+/**
+ * @brief Correlation of two vectors, when tracking statistics the pearson sums of
+ *        the candidate pairs are kept in `local`
+ * 
+ * @param x
+ * @param y
+ * @param local statistics of the calling thread
+ * @param keys feature indices of the pair
+ * @return correlation coefficient 
+ */
+double CorrPairs::correlate(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y, SuffStats& local, std::initializer_list<uint32_t> keys) {
+    if (!track) return func(x, y);
+    double sums[Algorithm::PEARSON_SUMS] = {0};
+    Algorithm::pearsonSums(x, y, sums);
+    return correlate(sums, local, keys);
+}
+
+/**
+ * @brief Pearson correlation of the sums of a pair, kept in `local` if it is a candidate
+ * 
+ * @param sums count, sum x, sum y, sum x^2, sum y^2, sum xy
+ * @param local 
+ * @param keys 
+ * @return double 
+ */
+double CorrPairs::correlate(double* sums, SuffStats& local, std::initializer_list<uint32_t> keys) {
+    double r = Algorithm::pearsonFromSums(sums);
+    if (track && !std::isnan(r) && abs(static_cast<int>(std::round(r * 1000))) > candidate)
+        local.push(keys.begin(), sums);
+    return r;
+}
+
+/**
+ * @brief The sparse source data can stay sparse for the requested analysis
+ * 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::sparseKernels() const {
+    if (options.method != "pearson" || !options.runDir.empty()) return false;
+    return options.analysis != "pairs" || linearOperations();
+}
+
+/**
+ * @brief Operations of pairs mode, `all` stands for the four operations
+ * 
+ * @return operation names
+ */
+std::vector<std::string> CorrPairs::operationList() const {
+    if (options.operation == "all")
+        return {"add", "subtract", "multiply", "divide"};
+    std::vector<std::string> fields, ops;
+    Utils::split(options.operation, fields, ",");
+    for (const std::string& field : fields) {
+        std::string op = Utils::strip(field);
+        if (!op.empty() && std::find(ops.begin(), ops.end(), op) == ops.end())
+            ops.push_back(op);
+    }
+    return ops;
+}
+
+/**
+ * @brief All the operations are add or subtract, linear in the two features
+ * 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::linearOperations() const {
+    for (const std::string& op : operationList())
+        if (op != "add" && op != "subtract") return false;
+    return true;
+}
+
+/**
+ * @brief Column sums of sparse source data, the sums of the zeros are known
+ * 
+ */
+void CorrPairs::prepareSparse() {
+    if (source == nullptr || !source->is_sparse()) return;
+    ssparse = &source->sparse;
+    VectorXd ones = VectorXd::Ones(ssparse->rows());
+    sparseSum = ssparse->transpose() * ones;
+    sparseSumSq = ssparse->cwiseAbs2().transpose() * ones;
+}
+
+/**
+ * @brief Count, sum and sum of squares of the values of each target column that are not NaN
+ * 
+ * @return MatrixXd 3 x target columns
+ */
+MatrixXd CorrPairs::targetSums() const {
+    MatrixXd sums = MatrixXd::Zero(3, tdata.cols());
+    for (Index c = 0; c < tdata.cols(); ++c) {
+        for (Index r = 0; r < tdata.rows(); ++r) {
+            double y = tdata(r, c);
+            if (std::isnan(y)) continue;
+            sums(0, c) += 1;
+            sums(1, c) += y;
+            sums(2, c) += y * y;
+        }
+    }
+    return sums;
+}
+
+/**
+ * @brief Project the standardized columns on a basis of their dominant subspace. With z = Q p + e,
+ *        e orthogonal to Q, the correlation of two columns is p_a.p_b + e_a.e_b, so
+ *        |r(a, b)| <= |p_a.p_b| + |e_a| |e_b| is a guaranteed bound computed from the sketch only.
+ * 
+ * @param sketch coordinates p of every column (rank x columns)
+ * @param residual norm of e of every column
+ */
+void CorrPairs::sketchColumns(MatrixXd& sketch, VectorXd& residual) {
+    bool ranks = options.method == "spearman";
+    if (sourceStats.empty() || sourceStats.ranks != ranks)
+        sourceStats.compute(sdata, ranks, options.threads);
+    const MatrixXd& Z = sourceStats.z;
+    Index rank = std::min<Index>(options.sketch, Z.rows());
+    // randomized range finder with one power iteration, fixed seed for reproducible runs
+    std::mt19937 gen(42);
+    std::normal_distribution<double> normal;
+    MatrixXd omega = MatrixXd::NullaryExpr(Z.cols(), rank, [&]() { return normal(gen); });
+    MatrixXd Y = Z * omega;
+    Y = Z * (Z.transpose() * Y);
+    HouseholderQR<MatrixXd> qr(Y);
+    MatrixXd Q = qr.householderQ() * MatrixXd::Identity(Z.rows(), rank);
+    sketch.noalias() = Q.transpose() * Z;
+    residual.resize(Z.cols());
+    #pragma omp parallel for schedule(static)
+    for (Index c = 0; c < Z.cols(); ++c)
+        residual[c] = (Z.col(c) - Q * sketch.col(c)).norm();
+}
+
+/**
+ * @brief Correlation of two source features in the common kernel
+ * 
+ * @param i
+ * @param j
+ * @param S source data read by the calling thread
+ * @param Z standardized source columns read by the calling thread
+ * @param local statistics of the calling thread
+ * @return correlation, NaN for a pair without one
+ */
+double CorrPairs::commonCorrelation(int i, int j, const Map<const MatrixXd>& S, const Map<const MatrixXd>& Z, SuffStats& local) {
+    if (sparse()) {
+        double sums[Algorithm::PEARSON_SUMS] = {(double)sourceRows(), sparseSum[i], sparseSum[j],
+                                               sparseSumSq[i], sparseSumSq[j], Algorithm::sparseDot(*ssparse, i, j)};
+        return correlate(sums, local, {(uint32_t)i, (uint32_t)j});
+    }
+    // NaN-free columns are standardized once, their correlation is a dot product
+    if (!sourceStats.empty() && !track && sourceStats.complete(i) && sourceStats.complete(j)) {
+        if (sourceStats.norm[i] == 0 || sourceStats.norm[j] == 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        return Z.col(i).dot(Z.col(j));
+    }
+    return correlate(S.col(i), S.col(j), local, {(uint32_t)i, (uint32_t)j});
+}
+
+/**
+ * @brief Keep the correlation of a common pair if it passes the cutoff
+ * 
+ * @param tile
+ * @param iteration iteration of the collapsed loop of the tile
+ * @param i
+ * @param j
+ * @param r correlation, not NaN
+ * @param local pairs of the calling thread
+ * @return true if the pair passes
+ * @return false 
+ */
+bool CorrPairs::keepCommon(size_t tile, uint64_t iteration, int i, int j, double r, PairStore& local) {
+    tally(r);
+    int corr = static_cast<int>(std::round(r * 1000));
+    if (abs(corr) <= threshold) return false;
+    mark(tile, iteration, local);
+    local.push({(uint32_t)i, (uint32_t)j}, {(int16_t)corr});
+    collect(local, false);
+    return true;
+}
+
 /**
  * @brief Calculate correlation between features of the same type
  * 
+ * @param others engines whose correlations of the same pairs are computed in the same traversal,
+ *        an engine of the same method reuses the correlation of this one
  * @return true 
  * @return false 
  */
-bool CorrPairs::getCommonPairs() {
-    if (source->data.rows() == 0) {
+bool CorrPairs::getCommonPairs(const std::vector<CorrPairs*>& others) {
+    if (sourceRows() == 0) {
         std::cout << "[Common Pairs] - Expression file is empty." << std::endl;
         return false;
     }
-    std::cout << "[Common Pairs] - Start identifying pairs of related features for the same data." << std::endl;
-    int i, j;
-    int corr;
-    omp_set_num_threads(options->threads);
-    #pragma omp parallel for collapse(2) private(i, j, corr) schedule(static, options->block)
-    for (i = 0; i < source->data.cols(); ++i) {
-        for (j = 0; j < source->data.cols(); ++j) {
-            if (j <= i) continue;
-            corr = static_cast<int>(std::round(this->func(source->data.col(i), source->data.col(j)) * 1000));
-            if (!std::isnan(corr) && abs(corr) > threshold) {
-                #pragma omp critical
-                pairs.push_back({i, j, corr});
+    std::vector<CorrPairs*> engines = {this};
+    engines.insert(engines.end(), others.begin(), others.end());
+    std::cout << "[Common Pairs] - Start identifying pairs of related features for the same data";
+    if (!others.empty()) {
+        std::cout << ", " << engines.size() << " analyses (";
+        for (size_t e = 0; e < engines.size(); ++e)
+            std::cout << (e > 0 ? ", " : "") << engines[e]->options.method << " > " << engines[e]->options.threshold;
+        std::cout << ") in one traversal";
+    }
+    std::cout << "." << std::endl;
+    for (CorrPairs* engine : engines) {
+        engine->pairs.reset(2, 1);
+        engine->pairs.dicts = {engine->columns};
+        engine->pairs.keyNames = {"source", "target"};
+        engine->pairs.valNames = {"corr"};
+        engine->pairs.scales = {1000};
+    }
+    if (track) trackStats("common", 2);
+    int ncols = sourceCols();
+    omp_set_num_threads(options.threads);
+    // pairs of standardized columns whose sketch bound is below the cutoff are skipped,
+    // the others are computed exactly, so the pairs found are the same. A summary counts
+    // every correlation and screens none
+    bool screen = options.sketch > 0 && !track && !options.summary && options.method != "kendall" && !outOfCore() && !sparse();
+    MatrixXd sketch;
+    VectorXd residual;
+    if (screen) {
+        Metrics::Phase phase("sketch");
+        sketchColumns(sketch, residual);
+    }
+    double screenBound = (threshold + 0.5) / 1000 - 1e-9;
+    size_t screened = 0;
+    uint64_t evaluated = 0, skipped = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    std::vector<ColumnTile> tiles = columnTiles(featureIndex, selected, ncols, blockWidth());
+    // the standardized columns are read by every thread, a copy on each NUMA node
+    bool standardized = !sourceStats.empty() && !track;
+    std::vector<MatrixXd> zReplicas = standardized ? replicate(sourceStats.z) : std::vector<MatrixXd>();
+    std::vector<char> same(others.size());
+    for (size_t o = 0; o < others.size(); ++o)
+        same[o] = others[o]->options.method == options.method;
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        const Map<const MatrixXd> Z = numa.local(sourceStats.z, zReplicas);
+        std::vector<Map<const MatrixXd> > otherZ;
+        std::vector<PairStore> otherLocal;
+        for (size_t o = 0; o < others.size(); ++o) {
+            const MatrixXd& z = same[o] ? sourceStats.z : others[o]->sourceStats.z;
+            otherZ.emplace_back(z.data(), z.rows(), z.cols());
+            otherLocal.push_back(others[o]->pairs.layout());
+        }
+        PairStore local = pairs.layout();
+        SuffStats localStats(stats.nkeys(), stats.nstats());
+        for (size_t b = 0; b < tiles.size(); ++b) {
+            const ColumnTile& tile = tiles[b];
+            #pragma omp single
+            pageTile(source, b > 0 ? &tiles[b - 1] : nullptr, tile);
+            Timer work;
+            #pragma omp for collapse(2) schedule(static, options.block) reduction(+:screened, evaluated, skipped, emitted) nowait
+            for (int f = tile.f0; f < tile.f1; ++f) {
+                for (int j = tile.j0; j < tile.j1; ++j) {
+                    int i = featureIndex[f];
+                    if (counted(i, j)) continue;
+                    if (screen && sourceStats.complete(i) && sourceStats.complete(j) &&
+                        std::abs(sketch.col(i).dot(sketch.col(j))) + residual[i] * residual[j] < screenBound) {
+                        screened++;
+                        continue;
+                    }
+                    uint64_t iteration = (uint64_t)(f - tile.f0) * (tile.j1 - tile.j0) + (j - tile.j0);
+                    evaluated++;
+                    double r = commonCorrelation(i, j, S, Z, localStats);
+                    if (std::isnan(r))
+                        skipped++;
+                    else if (keepCommon(b, iteration, i, j, r, local))
+                        emitted++;
+                    // the columns of the pair are in cache for the other analyses
+                    for (size_t o = 0; o < others.size(); ++o) {
+                        evaluated++;
+                        double value = same[o] ? r : others[o]->commonCorrelation(i, j, S, otherZ[o], localStats);
+                        if (std::isnan(value))
+                            skipped++;
+                        else if (others[o]->keepCommon(b, iteration, i, j, value, otherLocal[o]))
+                            emitted++;
+                    }
+                }
             }
+            busy[omp_get_thread_num()] += work.elapsed();
+            #pragma omp barrier
+        }
+        collect(local, true);
+        for (size_t o = 0; o < others.size(); ++o)
+            others[o]->collect(otherLocal[o], true);
+        if (track) {
+            #pragma omp critical(stats)
+            stats.append(localStats);
         }
     }
+    if (screen)
+        std::cout << "[Common Pairs] - The sketch screened out " << screened << " pairs." << std::endl;
+    Metrics::global().countPairs(evaluated, screened, skipped, emitted, busy);
     std::cout << "[Common Pairs] - Successfully calculated all related features." << std::endl;
     return true;
 }
 
+/**
+ * @brief Pearson correlations of the NaN-free source features with the target features that have
+ *        NaN. The targets are grouped by the rows they have; for every pattern the sources are
+ *        centered and scaled over its rows once and the pattern is one product. The result is
+ *        the correlation over the complete observations of each pair, as `func` gives it.
+ * 
+ * @param targetStats statistics of the target data
+ * @param slot column of each selected target in `patterned`, -1 for targets without NaN
+ * @param patterned correlations, selected features x targets with NaN
+ */
+void CorrPairs::correlatePatterns(const ColumnStats& targetStats, std::vector<int>& slot, MatrixXd& patterned) {
+    int ntargets = targetIndex.size();
+    int nfeatures = featureIndex.size();
+    int nrows = tdata.rows();
+    std::map<std::vector<char>, std::vector<int> > patterns;
+    int nmissing = 0;
+    for (int t = 0; t < ntargets; ++t) {
+        int j = targetIndex[t];
+        if (targetStats.complete(j)) continue;
+        std::vector<char> valid(nrows);
+        for (int r = 0; r < nrows; ++r)
+            valid[r] = !std::isnan(tdata(r, j));
+        patterns[valid].push_back(t);
+        nmissing++;
+    }
+    // the correlations are kept for the whole run, unless they don't fit in 1 GiB
+    if (nmissing == 0 || static_cast<size_t>(nfeatures) * nmissing > (size_t(1) << 27)) return;
+    Metrics::Phase phase("patterns");
+    std::cout << "[Cross Pairs] - " << nmissing << " target features with NaN in " << patterns.size() << " patterns of missing samples." << std::endl;
+    patterned.resize(nfeatures, nmissing);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    int next = 0;
+    for (const auto& pattern : patterns) {
+        std::vector<int> rows;
+        for (int r = 0; r < nrows; ++r)
+            if (pattern.first[r]) rows.push_back(r);
+        int n = rows.size();
+        const std::vector<int>& group = pattern.second;
+        MatrixXd zt(n, group.size());
+        for (size_t g = 0; g < group.size(); ++g) {
+            int j = targetIndex[group[g]];
+            for (int r = 0; r < n; ++r)
+                zt(r, g) = tdata(rows[r], j);
+            zt.col(g).array() -= n > 0 ? zt.col(g).mean() : 0;
+            double norm = zt.col(g).norm();
+            // fewer than 2 observations or a constant column, no correlation
+            if (norm > 0) zt.col(g) /= norm;
+            else zt.col(g).setConstant(nan);
+            slot[group[g]] = next + g;
+        }
+        // source columns over the rows of the pattern, in blocks of at most 128 MB
+        int width = std::max<int>(1, std::min<size_t>(nfeatures, (size_t(1) << 24) / std::max(n, 1)));
+        MatrixXd zs(n, width);
+        for (int f0 = 0; f0 < nfeatures; f0 += width) {
+            int f1 = std::min(nfeatures, f0 + width);
+            #pragma omp parallel for schedule(static) num_threads(options.threads)
+            for (int f = f0; f < f1; ++f) {
+                int i = featureIndex[f];
+                if (!sourceStats.complete(i)) {
+                    zs.col(f - f0).setZero();
+                    continue;
+                }
+                for (int r = 0; r < n; ++r)
+                    zs(r, f - f0) = sdata(rows[r], i);
+                zs.col(f - f0).array() -= n > 0 ? zs.col(f - f0).mean() : 0;
+                double norm = zs.col(f - f0).norm();
+                if (norm > 0) zs.col(f - f0) /= norm;
+                else zs.col(f - f0).setConstant(nan);
+            }
+            patterned.block(f0, next, f1 - f0, group.size()).noalias() = zs.leftCols(f1 - f0).transpose() * zt;
+        }
+        next += group.size();
+    }
+}
+
 /**
  * @brief Calculate correlations between different types of features (eg. corr(expr(a), drug(d)))
  * 
@@ -97,26 +891,98 @@ bool CorrPairs::getCommonPairs() {
  */
 bool CorrPairs::getCrossPairs() {
     std::cout << "[Cross Pairs] - Start identifying correlations between different types of features." << std::endl;
-    if (source->data.rows() != target->data.rows()) {
+    if (sourceRows() != tdata.rows()) {
         std::cout << "[Cross Pairs] - The number of data lines in the two files is inconsistent." << std::endl;
         return false;
     }
-    int i, j;
-    int corr;
-    omp_set_num_threads(options->threads);
-    #pragma omp parallel for collapse(2) private(i, j, corr) schedule(static, options->block)
-    for (i = 0; i < source->data.cols(); ++i) {
-        for (j = 0; j < target->data.cols(); ++j) {
-            if (source->columns[i] == "TSPAN6 (7105)" && target->columns[j] == "ML210") {
-                std::cout << target->data(26, j);
-            }
-            corr = static_cast<int>(std::round(this->func(source->data.col(i), target->data.col(j)) * 1000));
-            if (!std::isnan(corr) && abs(corr) > threshold) {
-                #pragma omp critical
-                pairs.push_back({i, j, corr});
+    pairs.reset(2, 1);
+    pairs.dicts = {columns, targetColumns};
+    pairs.keyDict = {0, 1};
+    pairs.keyNames = {"source", "target"};
+    pairs.valNames = {"corr"};
+    pairs.scales = {1000};
+    if (track) trackStats("cross", 2);
+    // NaN-free columns are standardized once, their correlation is a dot product
+    bool standardized = !sourceStats.empty() && !track;
+    ColumnStats targetStats;
+    if (standardized)
+        targetStats.compute(tdata, sourceStats.ranks, options.threads);
+    int ntargets = targetIndex.size();
+    // targets with NaN share a few patterns of missing rows, their pearson correlations with
+    // the NaN-free sources are computed by pattern: patterned(f, slot[t])
+    std::vector<int> slot(ntargets, -1);
+    MatrixXd patterned;
+    if (standardized && options.method == "pearson")
+        correlatePatterns(targetStats, slot, patterned);
+    // the targets stay in memory, each source block is read once
+    std::vector<ColumnTile> tiles = columnTiles(featureIndex, selected, sourceCols(), blockWidth(), false);
+    MatrixXd tsums = sparse() ? targetSums() : MatrixXd();
+    uint64_t evaluated = 0, skipped = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    std::vector<MatrixXd> sourceZ = standardized ? replicate(sourceStats.z) : std::vector<MatrixXd>();
+    std::vector<MatrixXd> targetZ = standardized ? replicate(targetStats.z) : std::vector<MatrixXd>();
+    omp_set_num_threads(options.threads);
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        const Map<const MatrixXd> T = targetView();
+        const Map<const MatrixXd> ZS = numa.local(sourceStats.z, sourceZ);
+        const Map<const MatrixXd> ZT = numa.local(targetStats.z, targetZ);
+        PairStore local = pairs.layout();
+        SuffStats localStats(stats.nkeys(), stats.nstats());
+        for (size_t b = 0; b < tiles.size(); ++b) {
+            const ColumnTile& tile = tiles[b];
+            #pragma omp single
+            pageTile(source, b > 0 ? &tiles[b - 1] : nullptr, tile);
+            Timer work;
+            #pragma omp for collapse(2) schedule(static, options.block) reduction(+:evaluated, skipped, emitted) nowait
+            for (int f = tile.f0; f < tile.f1; ++f) {
+                for (int t = 0; t < ntargets; ++t) {
+                    int i = featureIndex[f];
+                    int j = targetIndex[t];
+                    evaluated++;
+                    double r;
+                    if (sparse()) {
+                        double sums[Algorithm::PEARSON_SUMS] = {0};
+                        Algorithm::sparseSums(*ssparse, i, -1, 0, T.col(j), tsums.col(j).data(), sums);
+                        r = correlate(sums, localStats, {(uint32_t)i, (uint32_t)j});
+                    } else if (standardized && sourceStats.complete(i) && targetStats.complete(j)) {
+                        // both columns are standardized, the correlation is their dot product
+                        if (sourceStats.norm[i] == 0 || targetStats.norm[j] == 0) {
+                            skipped++;
+                            continue;
+                        }
+                        r = ZS.col(i).dot(ZT.col(j));
+                    } else if (slot[t] >= 0 && sourceStats.complete(i)) {
+                        // over the rows of the target's pattern, NaN for a constant column
+                        r = patterned(f, slot[t]);
+                    } else {
+                        r = correlate(S.col(i), T.col(j), localStats, {(uint32_t)i, (uint32_t)j});
+                    }
+                    if (std::isnan(r)) {
+                        skipped++;
+                        continue;
+                    }
+                    tally(r);
+                    int corr = static_cast<int>(std::round(r * 1000));
+                    if (abs(corr) > threshold) {
+                        emitted++;
+                        mark(b, (uint64_t)(f - tile.f0) * ntargets + t, local);
+                        local.push({(uint32_t)i, (uint32_t)j}, {(int16_t)corr});
+                        collect(local, false);
+                    }
+                }
             }
+            busy[omp_get_thread_num()] += work.elapsed();
+            #pragma omp barrier
+        }
+        collect(local, true);
+        if (track) {
+            #pragma omp critical(stats)
+            stats.append(localStats);
         }
     }
+    Metrics::global().countPairs(evaluated, 0, skipped, emitted, busy);
     std::cout << "[Cross Pairs] - Successfully calculated all related features." << std::endl;
     return true;
 }
@@ -130,36 +996,231 @@ bool CorrPairs::getCrossPairs() {
  */
 bool CorrPairs::getPairsCross() {
     std::cout << "[Pairs Cross] - Begin to recognize the correlation of homotypic feature pairs with another type of features." << std::endl;
-    if (source->data.rows() != target->data.rows()) {
-        return false;
-    }
-    int k, i, j;
-    VectorXd res;
-    int corr;
-    omp_set_num_threads(options->threads);
-    #pragma omp parallel for collapse(3) private(k, i, j, res, corr) schedule(static, options->block)
-    for (k = 0; k < target->data.cols(); ++k) {
-        for (i = 0; i < source->data.cols(); ++i) {
-            for (j = 0; j < source->data.cols(); ++j) {
-                if (j <= i) continue;
-                if (i == 0 && j == 1) {
-                    #pragma omp critical
-                    std::cout << "[Pairs Cross] - Feature: " << target->columns[k] << std::endl;
-                }
-                res = Algorithm::column_operate(source->data, i, j, options->operation);
-                corr = static_cast<int>(std::round(this->func(res, target->data.col(k)) * 1000));
-                if (!std::isnan(corr) && abs(corr) > threshold)
-                    #pragma omp critical
-                    {
-                        pairs.push_back({k, i, j, corr});
+    if (sourceRows() != tdata.rows()) {
+        return false;
+    }
+    std::vector<std::string> operations = operationList();
+    // sign of a +/- b, 0 for the other operations
+    std::vector<double> signs;
+    for (const std::string& op : operations) {
+        if (op != "add" && op != "subtract" && op != "multiply" && op != "divide") {
+            std::cerr << "[Pairs Cross] - Invalid operation: " << op << std::endl;
+            return false;
+        }
+        signs.push_back(op == "add" ? 1 : op == "subtract" ? -1 : 0);
+    }
+    int nops = operations.size();
+    if (nops == 0) {
+        std::cerr << "[Pairs Cross] - No operation is given." << std::endl;
+        return false;
+    }
+    if (nops > 1 && track) {
+        std::cerr << "[Pairs Cross] - Sufficient statistics are only available for a single operation." << std::endl;
+        return false;
+    }
+    if (nops == 1) {
+        pairs.reset(3, 1);
+        pairs.dicts = {targetColumns, columns};
+        pairs.keyDict = {0, 1, 1};
+        pairs.keyNames = {"feature", "source", "target"};
+        pairs.valNames = {std::string("corr(source") + Utils::getOperation(operations[0]) + "target)"};
+    } else {
+        // the operation is a key of the pairs, named in its own dictionary
+        pairs.reset(4, 1);
+        pairs.dicts = {targetColumns, columns, operations};
+        pairs.keyDict = {0, 1, 1, 2};
+        pairs.keyNames = {"feature", "source", "target", "operation"};
+        pairs.valNames = {"corr"};
+    }
+    pairs.scales = {1000};
+    if (track) trackStats("pairs", 3);
+    int ncols = sourceCols();
+    int nfeatures = featureIndex.size();
+    int ntargets = targetIndex.size();
+    omp_set_num_threads(options.threads);
+    // for a +/- b the pearson correlation with d follows from the norms of the centered
+    // columns and corr(a, d), corr(b, d), corr(a, b), computed once for all triples
+    bool prune = options.method == "pearson" && std::count(signs.begin(), signs.end(), 0.0) < nops &&
+                 !outOfCore() && !sparse();
+    MatrixXd tsums = sparse() ? targetSums() : MatrixXd();
+    // triples tracked for the update subcommand pass the candidate threshold
+    double pruneBound = ((track ? candidate : threshold) + 0.5) / 1000 - 1e-6;
+    ColumnStats targetStats;
+    MatrixXd sourceTarget, sourceGram;
+    bool gram = false;
+    if (prune) {
+        Metrics::Phase phase("bounds");
+        if (sourceStats.empty() || sourceStats.ranks)
+            sourceStats.compute(sdata, false, options.threads);
+        targetStats.compute(tdata, false, options.threads);
+        sourceTarget.noalias() = sourceStats.z.transpose() * targetStats.z;
+        // the gene-gene correlations of the selected features, unless they don't fit in 1 GiB
+        gram = static_cast<size_t>(nfeatures) * ncols <= (size_t(1) << 27);
+        if (gram) {
+            sourceGram.resize(nfeatures, ncols);
+            #pragma omp parallel for schedule(static)
+            for (int f = 0; f < nfeatures; ++f)
+                sourceGram.row(f).noalias() = sourceStats.z.col(featureIndex[f]).transpose() * sourceStats.z;
+        }
+    }
+    size_t pruned = 0;
+    uint64_t evaluated = 0, skipped = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    std::vector<ColumnTile> tiles = columnTiles(featureIndex, selected, ncols, blockWidth());
+    // without the gene-gene matrix the bounds read the standardized columns
+    std::vector<MatrixXd> zReplicas = prune && !gram ? replicate(sourceStats.z) : std::vector<MatrixXd>();
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        const Map<const MatrixXd> T = targetView();
+        const Map<const MatrixXd> Z = numa.local(sourceStats.z, zReplicas);
+        PairStore local = pairs.layout();
+        SuffStats localStats(stats.nkeys(), stats.nstats());
+        VectorXd res;
+        for (size_t b = 0; b < tiles.size(); ++b) {
+            const ColumnTile& tile = tiles[b];
+            #pragma omp single
+            pageTile(source, b > 0 ? &tiles[b - 1] : nullptr, tile);
+            Timer work;
+            #pragma omp for collapse(3) schedule(static, options.block) reduction(+:pruned, evaluated, skipped, emitted) nowait
+            for (int t = 0; t < ntargets; ++t) {
+                for (int f = tile.f0; f < tile.f1; ++f) {
+                    for (int j = tile.j0; j < tile.j1; ++j) {
+                        int k = targetIndex[t];
+                        int i = featureIndex[f];
+                        if (b == 0 && f == tile.f0 && j == tile.j0) {
+                            #pragma omp critical
+                            std::cout << "[Pairs Cross] - Feature: " << targetColumns[k] << std::endl;
+                        }
+                        if (counted(i, j)) continue;
+                        bool bounded = prune && sourceStats.complete(i) && sourceStats.complete(j) && targetStats.complete(k) &&
+                                       targetStats.norm[k] > 0;
+                        double rab = bounded ? (gram ? sourceGram(f, j) : Z.col(i).dot(Z.col(j))) : 0;
+                        // every operation of the two columns while they are in cache
+                        for (int o = 0; o < nops; ++o) {
+                            double sign = signs[o];
+                            if (bounded && sign != 0) {
+                                double na = sourceStats.norm[i], nb = sourceStats.norm[j];
+                                double var = na * na + nb * nb + 2 * sign * na * nb * rab;
+                                // a +/- b close to constant loses precision, leave it to the exact computation
+                                if (var > 1e-6 * (na * na + nb * nb)) {
+                                    double r = (na * sourceTarget(i, k) + sign * nb * sourceTarget(j, k)) / std::sqrt(var);
+                                    if (std::abs(r) < pruneBound) {
+                                        // the correlation itself, only left out of the pairs
+                                        tally(r);
+                                        pruned++;
+                                        continue;
+                                    }
+                                }
+                            }
+                            evaluated++;
+                            double r;
+                            if (sparse()) {
+                                // a +/- b over the union of the non-zero rows of a and b
+                                double sums[Algorithm::PEARSON_SUMS] = {0};
+                                Algorithm::sparseSums(*ssparse, i, j, sign, T.col(k), tsums.col(k).data(), sums);
+                                r = correlate(sums, localStats, {(uint32_t)k, (uint32_t)i, (uint32_t)j});
+                            } else {
+                                res = Algorithm::column_operate(S, i, j, operations[o]);
+                                r = correlate(res, T.col(k), localStats, {(uint32_t)k, (uint32_t)i, (uint32_t)j});
+                            }
+                            if (std::isnan(r)) {
+                                skipped++;
+                                continue;
+                            }
+                            tally(r);
+                            int16_t corr = static_cast<int16_t>(std::round(r * 1000));
+                            if (abs(corr) > threshold) {
+                                emitted++;
+                                // the operation key is left out with a single operation
+                                uint32_t keys[4] = {(uint32_t)k, (uint32_t)i, (uint32_t)j, (uint32_t)o};
+                                mark(b, ((uint64_t)t * (tile.f1 - tile.f0) + (f - tile.f0)) * (tile.j1 - tile.j0) + (j - tile.j0), local);
+                                local.push(keys, &corr);
+                                collect(local, false);
+                            }
+                        }
                     }
+                }
             }
+            busy[omp_get_thread_num()] += work.elapsed();
+            #pragma omp barrier
+        }
+        collect(local, true);
+        if (track) {
+            #pragma omp critical(stats)
+            stats.append(localStats);
         }
     }
+    Metrics::global().countPairs(evaluated, pruned, skipped, emitted, busy);
+    if (prune)
+        std::cout << "[Pairs Cross] - Pruned " << pruned << " triples below the cutoff by the correlations of their features." << std::endl;
     std::cout << "[Pairs Cross] - Successfully calculated all correlation gene pairs." << std::endl;
     return true;
 }
 
+/**
+ * @brief Prepare a computation: the output buffers, the NUMA copies and the standardized columns
+ * 
+ * @param standardizeColumns false when the standardized columns of another engine are read
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::prepare(bool standardizeColumns) {
+    if (options.numa) {
+        Metrics::Phase phase("preprocess");
+        // the standardized columns are replicated by the kernels that read them
+        numa.place(options.threads, sdata, tdata, "Correlation Pairs");
+    }
+    if (options.summary) {
+        if (Utils::endsWith(options.output, ".gpb")) {
+            std::cerr << "[Correlation Pairs] - The summary is written as text, give a text output with -o." << std::endl;
+            return false;
+        }
+        summary.reset(options.threads);
+    }
+    order.reset(options.threads, options.block);
+    if (outOfCore()) {
+        std::cout << "[Correlation Pairs] - The data stays on disk, blocks of " << blockWidth() << " features are streamed through memory." << std::endl;
+    }
+    track = !options.stats.empty();
+    if (track && options.method != "pearson") {
+        std::cerr << "[Correlation Pairs] - Sufficient statistics are only available for pearson correlations." << std::endl;
+        return false;
+    }
+    // standardized source columns, shared by the kernels and kept with a run directory
+    bool standardize = standardizeColumns && ((options.analysis != "pairs" && !track) || !options.runDir.empty()) && !outOfCore() && !sparse();
+    if (standardize && sourceStats.empty() && options.method != "kendall") {
+        Metrics::Phase phase("preprocess");
+        sourceStats.compute(sdata, options.method == "spearman", options.threads);
+    }
+    return true;
+}
+
+/**
+ * @brief Put the pairs of the threads in order and save the statistics of a computation
+ * 
+ * @param timer started with the computation
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::finish(const Timer& timer) {
+    bool success = true;
+    // pairs of the threads in the order of a sequential run
+    {
+        Metrics::Phase phase("merge");
+        order.concat(pairs);
+    }
+    if (track) {
+        Metrics::Phase phase("write");
+        stats.layout = pairs.layout();
+        stats.layout.dicts = pairs.dicts;
+        success = stats.save(options.stats);
+        std::cout << "[Correlation Pairs] - Saved the statistics of " << stats.size() << " candidate pairs to " << options.stats << std::endl;
+    }
+    std::cout << "[Correlation Pairs] - The calculation time is: " << timer << std::endl;
+    return success;
+}
+
 /**
  * @brief External interface, task scheduling
  * 
@@ -167,50 +1228,235 @@ bool CorrPairs::getPairsCross() {
  * @return false 
  */
 bool CorrPairs::getPairs() {
+    if (complete) return true;
     bool success;
     Timer timer = Timer();
-    if (options->analysis == "common") {
-        success = getCommonPairs();
-    } else if (options->analysis == "cross") {
-        success = getCrossPairs();
-    } else if (options->analysis == "pairs") {
-        success = getPairsCross();
-    } else {
-        std::cout << "[Correlation Pairs] - This type of analysis is not supported: " << timer << std::endl;
+    if (!prepare()) {
         return false;
     }
-    std::cout << "[Correlation Pairs] - The calculation time is: " << timer << std::endl;
-    return success;
+    {
+        Metrics::Phase phase("compute", options.threads);
+        if (options.analysis == "common") {
+            success = getCommonPairs();
+        } else if (options.analysis == "cross") {
+            success = getCrossPairs();
+        } else if (options.analysis == "pairs") {
+            success = getPairsCross();
+        } else {
+            std::cout << "[Correlation Pairs] - This type of analysis is not supported: " << timer << std::endl;
+            return false;
+        }
+    }
+    if (!success) {
+        std::cout << "[Correlation Pairs] - The calculation time is: " << timer << std::endl;
+        return false;
+    }
+    return finish(timer);
 }
 
-bool CorrPairs::writePairs() {
-    std::ofstream outputFile(options->output);
-    if (!outputFile.is_open()) {
-        std::cerr << "[Correlation Pairs] - Failed to open file." << std::endl;
+/**
+ * @brief Whether the common pairs of another engine can be computed in the same traversal as
+ *        the pairs of this one: the same data, features and schedule, pearson or spearman
+ *        correlations of standardized columns, nothing that changes the loop of one of them
+ * 
+ * @param other
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::fusable(const CorrPairs& other) const {
+    for (const CorrPairs* engine : {this, &other}) {
+        const CorrOptions& opt = engine->options;
+        if (opt.analysis != "common" || (opt.method != "pearson" && opt.method != "spearman") || !opt.stats.empty() ||
+            opt.sketch > 0 || opt.plan || opt.numa || !opt.runDir.empty() || engine->sparse() || engine->outOfCore())
+            return false;
+    }
+    return sdata.data() == other.sdata.data() && sdata.rows() == other.sdata.rows() && sdata.cols() == other.sdata.cols() &&
+           featureIndex == other.featureIndex && options.threads == other.options.threads && options.block == other.options.block;
+}
+
+/**
+ * @brief Compute the common pairs of this engine and of other ones over the same data in a
+ *        single traversal of the pairs, eg. the pearson and spearman correlations of a file.
+ *        Each engine keeps its own cutoff, pairs and output, the engines of the same method
+ *        as this one reuse its standardized columns and correlations.
+ * 
+ * @param others engines fusable with this one
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::getPairsWith(const std::vector<CorrPairs*>& others) {
+    for (CorrPairs* other : others) {
+        if (!fusable(*other)) {
+            std::cerr << "[Correlation Pairs] - The analyses cannot share a traversal of the pairs." << std::endl;
+            return false;
+        }
+    }
+    Timer timer = Timer();
+    if (!prepare()) {
         return false;
     }
+    for (CorrPairs* other : others) {
+        if (!other->prepare(other->options.method != options.method)) return false;
+    }
+    bool success;
+    {
+        Metrics::Phase phase("compute", options.threads);
+        success = getCommonPairs(others);
+    }
+    if (!success || !finish(timer)) {
+        return false;
+    }
+    for (CorrPairs* other : others) {
+        if (!other->finish(timer)) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Estimate the run without computing it: the pairs are counted, a random sample of
+ *        them is evaluated for the hit rate and timed on one thread with the kernel of the run
+ * 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::plan() {
+    if (complete) return true;
+    Metrics::Phase phase("plan");
+    bool common = options.analysis == "common", cross = options.analysis == "cross", pairsMode = options.analysis == "pairs";
+    if (!common && !cross && !pairsMode) {
+        std::cerr << "[Correlation Pairs] - This type of analysis is not supported: " << options.analysis << std::endl;
+        return false;
+    }
+    if (!common && sourceRows() != tdata.rows()) {
+        std::cerr << "[Correlation Pairs] - The number of data lines in the two files is inconsistent." << std::endl;
+        return false;
+    }
+    std::vector<std::string> operations = pairsMode ? operationList() : std::vector<std::string>{options.operation};
+    uint64_t nf = featureIndex.size(), ncols = sourceCols(), nt = targetIndex.size(), nops = operations.size();
+    if (nf == 0 || (!common && nt == 0) || nops == 0) {
+        std::cerr << "[Correlation Pairs] - Nothing to evaluate." << std::endl;
+        return false;
+    }
+    Plan plan;
+    plan.threads = options.threads;
+    plan.binary = Utils::endsWith(options.output, ".gpb");
+    plan.stored = !sink && !options.summary;
+    plan.units = common ? Plan::pairUnits(nf, ncols) : cross ? nf * nt : nt * Plan::pairUnits(nf, ncols) * nops;
+
+    // data, standardized copies and the products of pruning
+    double rows = sourceRows();
+    plan.dataBytes = sparse() ? ssparse->nonZeros() * 12.0 : outOfCore() ? options.memoryLimit * 1048576.0 : rows * ncols * 8;
+    plan.dataBytes += tdata.size() * 8.0;
+    bool dense = !sparse() && !outOfCore() && options.stats.empty();
+    if (dense && options.method != "kendall" && !pairsMode)
+        plan.dataBytes += rows * ncols * 8 + (cross ? tdata.size() * 8.0 : 0);
+    if (dense && pairsMode && options.method == "pearson" && linearOperations()) {
+        double gram = 8.0 * nf * ncols;
+        plan.dataBytes += rows * ncols * 8 + tdata.size() * 8.0 + 8.0 * ncols * tdata.cols() + (gram <= 1073741824.0 ? gram : 0);
+    }
+
+    // results: feature names, delimiters and a value of about 6 characters
+    size_t nkeys = pairsMode ? (nops > 1 ? 4 : 3) : 2;
+    plan.recordBytes = 4.0 * nkeys + 2;
+    double names = common ? 2 * Plan::meanLength(columns) :
+                   cross ? Plan::meanLength(columns) + Plan::meanLength(targetColumns) :
+                   Plan::meanLength(targetColumns) + 2 * Plan::meanLength(columns) + (nops > 1 ? Plan::meanLength(operations) : 0);
+    plan.lineBytes = options.summary ? 0 : names + nkeys + 6 + 1;
+
+    std::mt19937_64 rng(42);
+    uint64_t n = std::min<uint64_t>(plan.units, Plan::SAMPLE);
+    // the two source columns of a sampled sparse pair
+    MatrixXd cols(sparse() ? sourceRows() : 0, 2);
+    auto evaluate = [&](int i, int j, int k, int o) -> double {
+        const Ref<const MatrixXd> M = sparse() ? Ref<const MatrixXd>(cols) : Ref<const MatrixXd>(sdata);
+        if (sparse()) {
+            cols.col(0) = ssparse->col(i);
+            cols.col(1) = ssparse->col(j);
+            i = 0;
+            j = 1;
+        }
+        if (common) return func(M.col(i), M.col(j));
+        if (cross) return func(M.col(i), tdata.col(k));
+        return func(Algorithm::column_operate(M, i, j, operations[o]), tdata.col(k));
+    };
+    std::vector<std::array<int, 4> > sample;
+    for (uint64_t draws = 0; sample.size() < n && draws < 100 * n; ++draws) {
+        int i = featureIndex[rng() % nf];
+        int j = cross ? 0 : rng() % ncols;
+        int k = common ? 0 : targetIndex[rng() % nt];
+        int o = pairsMode ? rng() % nops : 0;
+        if (!cross && counted(i, j)) continue;
+        sample.push_back({i, j, k, o});
+    }
+    for (const std::array<int, 4>& u : sample) {
+        double r = evaluate(u[0], u[1], u[2], u[3]);
+        if (!std::isnan(r) && abs(static_cast<int>(std::round(r * 1000))) > threshold)
+            plan.hits++;
+    }
+    plan.sampled = sample.size();
+    // calibration of the kernel of the run: complete columns of pearson and spearman
+    // runs are standardized once and correlated by a dot product
+    bool standardized = dense && options.method != "kendall" && !pairsMode;
+    volatile double checksum = 0;  // the calibration is not optimized away
+    Timer timer;
+    for (const std::array<int, 4>& u : sample) {
+        if (standardized)
+            checksum += sdata.col(u[0]).dot(common ? sdata.col(u[1]) : tdata.col(u[2]));
+        else
+            checksum += evaluate(u[0], u[1], u[2], u[3]);
+    }
+    plan.seconds = timer.elapsed();
+    plan.report("Correlation Pairs");
+    return true;
+}
+
+/**
+ * @brief Write gene pairs to file, `.gpb` files are written in the binary pair format
+ * 
+ * @return true 
+ * @return false 
+ */
+bool CorrPairs::writePairs() {
+    if (complete) return true;
+    Metrics::Phase phase("write");
+    if (options.summary) {
+        std::cout << "[Correlation Pairs] - Total number of gene pairs: " << summary.size() << std::endl;
+        if (appendOutput) {
+            std::cerr << "[Correlation Pairs] - A summary does not append to the pairs of the run, give a new output with -o." << std::endl;
+            return false;
+        }
+        if (!summary.write(options.output, pairs, options.threads))
+            return false;
+        return options.runDir.empty() || saveRun();
+    }
     std::cout << "[Correlation Pairs] - Total number of gene pairs: " << pairs.size() << std::endl;
-    char outDelim = Utils::getDelim(options->output);
-    std::cout << "[Correlation Pairs] - Start writing the results to " << options->output << std::endl;
-    
-    if (options->analysis == "common") {
-        outputFile << "source" << outDelim << "target" << outDelim << "corr" << std::endl;
-        for (const auto& pair : pairs)
-            outputFile << source->columns[pair[0]] << outDelim << source->columns[pair[1]] << outDelim << 1.0 * pair[2] / 1000 << std::endl;
-    } else if (options->analysis == "cross") {
-        outputFile << "source" << outDelim << "target" << outDelim << "corr" << std::endl;
-        for (const auto& pair : pairs)
-            outputFile << source->columns[pair[0]] << outDelim << target->columns[pair[1]] << outDelim << 1.0 * pair[2] / 1000 << std::endl;
-    } else if (options->analysis == "pairs") {
-        outputFile << "feature" << outDelim << "source" << outDelim << "target" << outDelim << \
-                    "corr(source" << Utils::getOperation(options->operation) << "target)" << std::endl;
-        for (const auto& pair : pairs)
-            outputFile << target->columns[pair[0]] << outDelim << source->columns[pair[1]] << outDelim << \
-                source->columns[pair[2]] << outDelim << 1.0 * pair[3] / 1000 << std::endl;
-    }
-
-    // 关闭文件
-    outputFile.close();
+    if (options.sort) {
+        Metrics::Phase sorting("sort");
+        pairs.sort();
+    }
+    std::cout << "[Correlation Pairs] - Start writing the results to " << options.output << std::endl;
+    if (Utils::endsWith(options.output, ".gpb")) {
+        if (appendOutput) {
+            std::cerr << "[Correlation Pairs] - Binary pair files cannot be appended, give a new output with -o." << std::endl;
+            return false;
+        }
+        if (!pairs.save(options.output)) {
+            std::cerr << "[Correlation Pairs] - Failed to write file." << std::endl;
+            return false;
+        }
+    } else {
+        OutputStream outputFile(options.output, options.threads, appendOutput);
+        if (!outputFile.is_open()) {
+            std::cerr << "[Correlation Pairs] - Failed to open file." << std::endl;
+            return false;
+        }
+        pairs.write(outputFile, Utils::getDelim(options.output), !appendOutput, options.threads);
+        // 关闭文件
+        outputFile.close();
+    }
     std::cout << "[Correlation Pairs] - Writing is completed." << std::endl;
+    if (!options.runDir.empty()) {
+        return saveRun();
+    }
     return true;
-}
\ No newline at end of file
+}
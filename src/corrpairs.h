@@ -10,18 +10,41 @@
 #include "timer.h"
 #include "algorithm.h"
 #include "dataframe.h"
+#include "pairstore.h"
+#include "numa.h"
+#include "suffstats.h"
+#include "colstats.h"
+#include "tiles.h"
+#include "summary.h"
+#include "plan.h"
+#include "metrics.h"
+#include "covariates.h"
 
 struct CorrOptions
 {
     std::string expression;
     std::string target;
+    std::string features;
+    std::string targets;
     std::string output;
     std::string method;
-    std::string operation;
+    std::string operation;      // add/subtract/multiply/divide, a comma separated list or all (pairs mode)
     std::string analysis;
     double threshold = 0.3;
     size_t block = 0;
     size_t threads = 2;
+    std::string runDir;         // cache of the source data for --append-targets
+    std::string appendTargets;  // new target file of a previous cross/pairs run
+    std::string stats;          // save the sufficient statistics of the candidate pairs (pearson)
+    double slack = 0.1;         // candidates pass the cutoff lowered by slack
+    size_t sketch = 0;          // rank of the sketch screening common pairs, 0 for none
+    size_t memoryLimit = 0;     // MB of source data kept in memory, the rest stays on disk, 0 for no limit
+    std::string cacheDir;       // binary matrices converted for memoryLimit, next to the data files if empty
+    std::string covariates;     // covariates regressed out of the source and target data (partial correlations)
+    bool summary = false;       // only keep the distribution of the pairs
+    bool plan = false;          // only estimate the work, memory and output of the run
+    bool sort = false;
+    bool numa = false;
 };
 
 class CorrPairs
@@ -30,26 +53,119 @@ private:
     /* data */
     bool getCrossPairs();
     bool getPairsCross();
-    bool getCommonPairs();
+    bool getCommonPairs(const std::vector<CorrPairs*>& others={});
+    double commonCorrelation(int i, int j, const Map<const MatrixXd>& S, const Map<const MatrixXd>& Z, SuffStats& local);
+    bool keepCommon(size_t tile, uint64_t iteration, int i, int j, double r, PairStore& local);
+    bool prepare(bool standardize=true);
+    bool finish(const Timer& timer);
+    void correlatePatterns(const ColumnStats& targetStats, std::vector<int>& slot, MatrixXd& patterned);
+    void collect(PairStore& local, bool final);
+    // the histograms of a summary count every evaluated pair, not only the pairs passing
+    void tally(double value) { if (options.summary) summary.tally(omp_get_thread_num(), 0, value); }
+
+    // pairs kept in `pairs` are concatenated in the order of the loops
+    TileOrder order;
+    void mark(size_t tile, uint64_t iteration, const PairStore& local);
 
     // function pointer
-    std::function<double(const VectorXd&, const VectorXd&)> func;
+    CorrFunc func;
 
     int threshold;
 
+    // sufficient statistics of the pairs above the candidate threshold
+    bool track = false;
+    int candidate = 0;
+    void trackStats(const std::string& mode, size_t nkeys);
+
+    // operations of pairs mode, several with --operation all or a comma separated list
+    std::vector<std::string> operationList() const;
+    bool linearOperations() const;
+
+    void sketchColumns(MatrixXd& sketch, VectorXd& residual);
+    double correlate(const Ref<const VectorXd>& x, const Ref<const VectorXd>& y, SuffStats& local, std::initializer_list<uint32_t> keys);
+    double correlate(double* sums, SuffStats& local, std::initializer_list<uint32_t> keys);
+
+    // features enumerated as the first element of the pairs and target features, all by default
+    std::vector<int> featureIndex;
+    std::vector<int> targetIndex;
+    std::vector<char> selected;
+    // the pair was already enumerated from feature j
+    bool counted(int i, int j) const { return j == i || (j < i && selected[j]); }
+
+    PairSink sink;
+    size_t batchSize = 0;
+
+    // copies of the data on each NUMA node, empty without --numa
+    Numa numa;
+    Map<const MatrixXd> sourceView() const;
+    Map<const MatrixXd> targetView() const;
+    // standardized columns are replicated by the kernels that read them
+    std::vector<MatrixXd> replicate(const MatrixXd& z) const;
+
+    // sparse source data, the kernels only read its non-zero values
+    const SparseMatrix<double>* ssparse = nullptr;
+    VectorXd sparseSum;      // sum of each source column
+    VectorXd sparseSumSq;    // sum of squares of each source column
+    bool sparse() const { return ssparse != nullptr; }
+    bool sparseKernels() const;
+    void prepareSparse();
+    MatrixXd targetSums() const;
+    Index sourceRows() const { return sparse() ? ssparse->rows() : sdata.rows(); }
+    Index sourceCols() const { return sparse() ? ssparse->cols() : sdata.cols(); }
+
+    // the source data is mapped and streamed in column blocks under --memory-limit
+    bool outOfCore() const { return source != nullptr && source->is_mapped(); }
+    int blockWidth() const;
+
+    void init();
+    void setup();
+    bool adjustCovariates(DataFrame* data);
+
+    // source and target are deleted with the engine unless they belong to the caller
+    bool ownsData = true;
+
+    // run directory
+    bool appendOutput = false;
+    bool complete = false;      // the targets to append were all computed by the previous runs
+    bool loadRun();
+    bool saveRun();
+
 public:
     DataFrame *source = nullptr;
     DataFrame *target = nullptr;
+    CorrOptions options;
+    std::vector<std::string> columns;        // source feature names
+    std::vector<std::string> targetColumns;  // target feature names
     // feature, source, target, corr
-    std::vector<std::vector<int> > pairs;
-    CorrOptions *options;
+    PairStore pairs;
+    SuffStats stats;   // only filled with options.stats
+    Summary summary;   // only filled with options.summary, instead of pairs
+    ColumnStats sourceStats;  // standardized source columns, kept with a run directory
+
+    // views of the source and target data, no copy of the caller's buffers
+    Map<const MatrixXd> sdata{nullptr, 0, 0};
+    Map<const MatrixXd> tdata{nullptr, 0, 0};
 
     CorrPairs();
-    CorrPairs(CorrOptions *opts);
+    CorrPairs(const CorrOptions& opts);
+    CorrPairs(const CorrOptions& opts, const Map<const MatrixXd>& sourceData);
+    CorrPairs(const CorrOptions& opts, const Map<const MatrixXd>& sourceData, const Map<const MatrixXd>& targetData);
+    CorrPairs(const CorrOptions& opts, DataFrame* sourceFrame, DataFrame* targetFrame);
     ~CorrPairs();
+    // owns the loaded frames and maps its own matrices, a copy would delete them twice
+    CorrPairs(const CorrPairs&) = delete;
+    CorrPairs& operator=(const CorrPairs&) = delete;
+
+    void setSink(PairSink callback, size_t batch=1 << 16);
+    bool setFeatures(const std::vector<std::string>& names);
+    bool setTargets(const std::vector<std::string>& names);
 
     bool getPairs();
+    // common pairs of two engines over the same data in one traversal
+    bool fusable(const CorrPairs& other) const;
+    bool getPairsWith(const std::vector<CorrPairs*>& others);
     bool writePairs();
+    bool plan();
 };
 
-#endif
\ No newline at end of file
+#endif
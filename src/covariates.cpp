@@ -0,0 +1,172 @@
+#include <map>
+#include <set>
+#include <cmath>
+
+#include <omp.h>
+
+#include "utils.h"
+#include "stream.h"
+#include "covariates.h"
+
+namespace {
+    bool parseNumber(const std::string& cell, double& value) {
+        try {
+            size_t used;
+            value = std::stod(cell, &used);
+            return used == cell.size();
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // NA, NaN, N/A, null or an empty cell
+    bool missingCell(const std::string& cell) {
+        std::string value = Utils::strip(cell);
+        Utils::str2lower(value);
+        return value.empty() || value == "na" || value == "nan" || value == "n/a" || value == "null";
+    }
+}
+
+Covariates::Covariates() {}
+
+/**
+ * @brief Read the covariates of the samples and factorize the design matrix
+ *
+ * @param filename
+ * @param samples sample names of the data, in the order of its rows
+ * @return true
+ * @return false
+ */
+bool Covariates::load(const std::string& filename, const std::vector<std::string>& samples) {
+    InputStream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "[Covariates] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    char delimiter = Utils::getDelim(filename);
+    std::string line;
+    std::vector<std::string> header, fields;
+    std::map<std::string, std::vector<std::string> > rows;
+    while (std::getline(file, line)) {
+        line = Utils::rstrip(line, "\n\r");
+        if (line.empty()) continue;
+        Utils::split(line, fields, std::string(1, delimiter));
+        if (header.empty()) {
+            header = fields;
+            continue;
+        }
+        if (fields.size() != header.size()) {
+            std::cerr << "[Covariates] - Line of " << fields[0] << " doesn't have " << header.size() << " fields." << std::endl;
+            return false;
+        }
+        rows[fields[0]] = std::vector<std::string>(fields.begin() + 1, fields.end());
+    }
+    if (header.size() < 2) {
+        std::cerr << "[Covariates] - No covariates in " << filename << std::endl;
+        return false;
+    }
+    std::vector<const std::vector<std::string>*> values;
+    for (const auto& sample : samples) {
+        auto it = rows.find(sample);
+        if (it == rows.end()) {
+            std::cerr << "[Covariates] - Sample " << sample << " has no covariates." << std::endl;
+            return false;
+        }
+        values.push_back(&it->second);
+    }
+    // a missing value would make a numeric covariate categorical, the samples can't be fitted
+    size_t incomplete = 0;
+    std::string first;
+    for (size_t r = 0; r < values.size(); ++r) {
+        for (size_t c = 0; c < values[r]->size(); ++c) {
+            if (!missingCell((*values[r])[c])) continue;
+            if (incomplete++ == 0)
+                first = samples[r] + " (" + header[c + 1] + ")";
+            break;
+        }
+    }
+    if (incomplete > 0) {
+        std::cerr << "[Covariates] - " << incomplete << " samples have missing covariates, eg. " << first
+                  << ". Fill the values or remove the samples from the data." << std::endl;
+        return false;
+    }
+
+    // numeric covariates are one column, the others one indicator per level but the first
+    Index n = samples.size();
+    std::vector<VectorXd> columns;
+    names.clear();
+    for (size_t c = 0; c + 1 < header.size(); ++c) {
+        VectorXd x(n);
+        bool numeric = true;
+        for (Index r = 0; r < n && numeric; ++r)
+            numeric = parseNumber((*values[r])[c], x[r]);
+        if (numeric) {
+            columns.push_back(x);
+            names.push_back(header[c + 1]);
+            continue;
+        }
+        std::set<std::string> levels;
+        for (Index r = 0; r < n; ++r)
+            levels.insert((*values[r])[c]);
+        for (auto level = std::next(levels.begin()); level != levels.end(); ++level) {
+            for (Index r = 0; r < n; ++r)
+                x[r] = (*values[r])[c] == *level ? 1 : 0;
+            columns.push_back(x);
+            names.push_back(header[c + 1] + "=" + *level);
+        }
+    }
+    design.resize(n, columns.size() + 1);
+    design.col(0).setOnes();
+    for (size_t c = 0; c < columns.size(); ++c)
+        design.col(c + 1) = columns[c];
+
+    ColPivHouseholderQR<MatrixXd> qr(design);
+    Index rank = qr.rank();
+    if (rank < design.cols())
+        std::cout << "[Covariates] - The covariates are collinear, " << design.cols() - rank << " columns are redundant." << std::endl;
+    if (rank >= n) {
+        std::cerr << "[Covariates] - More covariates than samples, nothing is left of the data." << std::endl;
+        return false;
+    }
+    basis = qr.householderQ() * MatrixXd::Identity(n, rank);
+    return true;
+}
+
+/**
+ * @brief Replace every column of the data with its residuals after regressing out the covariates
+ *
+ * @param data samples x features, rows in the order of the samples given to load
+ * @param threads
+ */
+void Covariates::residualize(MatrixXd& data, size_t threads) const {
+    std::vector<Index> complete, partial;
+    for (Index c = 0; c < data.cols(); ++c)
+        (data.col(c).array().isNaN().any() ? partial : complete).push_back(c);
+    // complete columns share the basis, a block of columns is one pair of matrix products
+    const Index width = 256;
+    Index nblocks = (complete.size() + width - 1) / width;
+    #pragma omp parallel for schedule(dynamic) num_threads(std::max<size_t>(threads, 1))
+    for (Index b = 0; b < nblocks; ++b) {
+        std::vector<Index> cols(complete.begin() + b * width, complete.begin() + std::min<Index>((b + 1) * width, complete.size()));
+        MatrixXd block = data(all, cols);
+        block -= basis * (basis.transpose() * block);
+        data(all, cols) = block;
+    }
+    // columns with NaN are fitted on their complete samples, their partners on all samples
+    if (!partial.empty())
+        std::cout << "[Covariates] - " << partial.size() << " columns with missing values are fitted on their complete samples, "
+                  << "their correlations approximate the partial correlations." << std::endl;
+    #pragma omp parallel for schedule(dynamic) num_threads(std::max<size_t>(threads, 1))
+    for (size_t p = 0; p < partial.size(); ++p) {
+        Index c = partial[p];
+        std::vector<Index> rows;
+        for (Index r = 0; r < data.rows(); ++r)
+            if (!std::isnan(data(r, c))) rows.push_back(r);
+        if (rows.empty()) continue;
+        MatrixXd X = design(rows, all);
+        VectorXd y = data(rows, c);
+        VectorXd fit = X * X.colPivHouseholderQr().solve(y);
+        for (size_t k = 0; k < rows.size(); ++k)
+            data(rows[k], c) = y[k] - fit[k];
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef COVARIATES_H
+#define COVARIATES_H
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+/**
+ * Covariates regressed out of the data before the correlations, the correlation of the
+ * residuals is the partial correlation. The design matrix (intercept, numeric covariates and
+ * indicators of the levels of categorical covariates but the first) is factorized once, the
+ * residuals of all complete columns are then Y - Q (Q^T Y). Columns with NaN are fitted on
+ * their complete samples while their partners are fitted on all samples, so the correlation of
+ * such a pair over its complete samples approximates the partial correlation.
+ *
+ * File layout: a header (index name, covariate names) and one line per sample, the samples
+ * are matched to the data by name. Missing covariates (NA, NaN or empty) are refused.
+ */
+class Covariates {
+public:
+    std::vector<std::string> names;   // columns of the design matrix, without the intercept
+
+    Covariates();
+
+    bool load(const std::string& filename, const std::vector<std::string>& samples);
+    void residualize(MatrixXd& data, size_t threads) const;
+    Index size() const { return names.size(); }
+
+private:
+    MatrixXd design;   // samples x (1 + covariates)
+    MatrixXd basis;    // orthonormal basis of the columns of the design matrix
+};
+
+#endif
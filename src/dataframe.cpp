@@ -1,9 +1,59 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+
 #include "dataframe.h"
 
+namespace {
+    const char MATRIX_MAGIC[4] = {'G', 'P', 'M', 'X'};
+    // version 2 aligns the values to 8 bytes so that they can be mapped in place,
+    // version 3 notes the size and modification time of the text file it was converted from
+    const uint32_t MATRIX_VERSION = 3;
+
+    uint64_t padding(uint64_t position) {
+        return (sizeof(double) - position % sizeof(double)) % sizeof(double);
+    }
+
+    // size and modification time (nanoseconds) of a file
+    bool fileStamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) return false;
+        size = info.st_size;
+#ifdef __APPLE__
+        mtime = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+        mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+        return true;
+    }
+
+    // first field of each line of a plain or compressed list, eg. features.tsv.gz
+    std::vector<std::string> readNames(const std::string& path) {
+        std::vector<std::string> names;
+        InputStream file(path);
+        std::string line;
+        while (file.is_open() && getline(file, line)) {
+            line = Utils::strip(line);
+            if (line.empty()) continue;
+            names.push_back(line.substr(0, line.find_first_of("\t ,")));
+        }
+        return names;
+    }
+}
 
 DataFrame::DataFrame() {}
 
 DataFrame::DataFrame(const string& filename) {
+    if (Utils::endsWith(filename, ".gpm")) {
+        read_binary(filename);
+        return;
+    }
+    if (Utils::endsWith(filename, ".mtx") || Utils::endsWith(filename, ".mtx.gz")) {
+        read_mtx(filename);
+        return;
+    }
     char delim = Utils::getDelim(filename);
     read_csv(filename, delim);
 }
@@ -35,7 +85,7 @@ bool DataFrame::read_csv(const std::string &filename, const char delimiter, bool
         return false;
     }
     // open file
-    std::ifstream file(filename);
+    InputStream file(filename);
     if (!file.is_open()) {
         std::cerr << "Error: could not open file " << filename << std::endl;
         // return MatrixType::Zero(0, 0);
@@ -76,6 +126,10 @@ bool DataFrame::read_csv(const std::string &filename, const char delimiter, bool
             this->data(row_index, col_index) = NAN;
         row_index++;
     }
+    if (file.bad()) {
+        std::cerr << "Error: could not read file " << filename << ", " << file.error() << std::endl;
+        return false;
+    }
     file.close();
     std::cout << "File reading completed." << std::endl;
     this->max_index_length = max(static_cast<int>(this->index_name.length()), this->max_index_length);
@@ -84,7 +138,7 @@ bool DataFrame::read_csv(const std::string &filename, const char delimiter, bool
 }
 
 bool DataFrame::to_csv(const std::string &filename, const char delimiter, bool header, bool index) {
-    std::ofstream outputFile(filename);
+    OutputStream outputFile(filename);
     if (!outputFile.is_open()) {
         std::cerr << "[Stable Pairs] - Failed to open file." << std::endl;
         return false;
@@ -107,6 +161,350 @@ bool DataFrame::to_csv(const std::string &filename, const char delimiter, bool h
     }
     return true;
 }
+/**
+ * @brief Load data from a binary matrix file, no parsing is needed
+ * 
+ * Layout (native byte order): magic "GPMX", u32 version, u64 rows, u64 cols,
+ * u64 size and i64 modification time of the converted text file, zero if none (version 3),
+ * index name, row names, column names, zero padding to a multiple of 8 bytes (version 2),
+ * rows * cols f64 values in column-major order
+ * 
+ * @param filename 
+ * @return true 
+ * @return false 
+ */
+bool DataFrame::read_binary(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    uint32_t version;
+    if (!file.is_open() || !read_header(file, version)) {
+        std::cerr << "Error: invalid binary matrix file " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Read data from file: " << filename << std::endl;
+    this->data.resize(nrows, ncols);
+    if (!file.read(reinterpret_cast<char*>(this->data.data()), nrows * ncols * sizeof(double))) {
+        std::cerr << "Error: truncated binary matrix file " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Data size: " << nrows << "x" << ncols << std::endl;
+    return true;
+}
+
+/**
+ * @brief Save data to a binary matrix file
+ * 
+ * @param filename 
+ * @return true 
+ * @return false 
+ */
+bool DataFrame::to_binary(const std::string &filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: could not open file " << filename << std::endl;
+        return false;
+    }
+    Map<const MatrixXd> values = view();
+    nrows = values.rows();
+    ncols = values.cols();
+    write_header(file);
+    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+    return static_cast<bool>(file);
+}
+
+/**
+ * @brief Map the values of a binary matrix file instead of reading them, only the names are loaded
+ * 
+ * @param filename 
+ * @return true 
+ * @return false 
+ */
+bool DataFrame::map_binary(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    uint32_t version;
+    if (!file.is_open() || !read_header(file, version)) {
+        std::cerr << "Error: invalid binary matrix file " << filename << std::endl;
+        return false;
+    }
+    if (version < 2) {
+        std::cerr << "Error: the values of " << filename << " are not aligned, convert the data again." << std::endl;
+        return false;
+    }
+    size_t offset = file.tellg();
+    size_t length = offset + nrows * ncols * sizeof(double);
+    file.seekg(0, std::ios::end);
+    if (static_cast<size_t>(file.tellg()) < length) {
+        std::cerr << "Error: truncated binary matrix file " << filename << std::endl;
+        return false;
+    }
+    file.close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    void* base = fd < 0 ? MAP_FAILED : mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        ::close(fd);
+    if (base == MAP_FAILED) {
+        std::cerr << "Error: could not map file " << filename << std::endl;
+        return false;
+    }
+    mapping.reset(base, [length](const void* p) { munmap(const_cast<void*>(p), length); });
+    mapped = reinterpret_cast<const double*>(static_cast<const char*>(base) + offset);
+    this->data.resize(0, 0);
+    std::cout << "Mapped data from file: " << filename << std::endl;
+    std::cout << "Data size: " << nrows << "x" << ncols << std::endl;
+    return true;
+}
+
+/**
+ * @brief Convert a text matrix to a binary matrix file without loading it, at most `memory` bytes
+ *        of values are parsed before they are written to their columns
+ * 
+ * @param filename text matrix
+ * @param binary binary matrix file
+ * @param memory 
+ * @return true 
+ * @return false 
+ */
+bool DataFrame::convert_binary(const std::string &filename, const std::string &binary, size_t memory) {
+    char delimiter = Utils::getDelim(filename);
+    if (!fileStamp(filename, source_size, source_mtime) || !getSize(filename, delimiter)) {
+        return false;
+    }
+    // the names precede the values in the binary file
+    InputStream names(filename);
+    std::string line, cell;
+    this->index.clear();
+    bool header = true;
+    while (getline(names, line)) {
+        if (line.empty()) continue;
+        stringstream ss(Utils::rstrip(line, "\n\r"));
+        if (header) {
+            getline(ss, this->index_name, delimiter);
+            for (size_t c = 0; c < ncols && getline(ss, cell, delimiter); ++c)
+                this->columns[c] = cell;
+            header = false;
+        } else {
+            getline(ss, cell, delimiter);
+            this->index.push_back(cell);
+        }
+    }
+    if (names.bad()) {
+        std::cerr << "Error: could not read file " << filename << ", " << names.error() << std::endl;
+        return false;
+    }
+    names.close();
+    nrows = this->index.size();
+
+    // written aside and renamed when complete, a run mapping the old file keeps reading it
+    std::string temporary = binary + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: could not open file " << temporary << std::endl;
+        return false;
+    }
+    write_header(file);
+    uint64_t offset = file.tellp();
+    std::cout << "Convert data from file: " << filename << " to " << binary << std::endl;
+    // rows parsed at a time, written as one segment of every column
+    size_t chunk = std::max<size_t>(memory / std::max<size_t>(ncols * sizeof(double), 1), 1);
+    MatrixXd block(std::min(chunk, nrows), ncols);
+    InputStream input(filename);
+    size_t row = 0, filled = 0;
+    header = true;
+    auto flush = [&]() {
+        for (size_t c = 0; c < ncols; ++c) {
+            file.seekp(offset + (c * nrows + row - filled) * sizeof(double));
+            file.write(reinterpret_cast<const char*>(block.col(c).data()), filled * sizeof(double));
+        }
+        filled = 0;
+    };
+    while (getline(input, line)) {
+        if (line.empty()) continue;
+        if (header) {
+            header = false;
+            continue;
+        }
+        std::string striped = Utils::rstrip(line, "\n\r");
+        stringstream ss(striped);
+        getline(ss, cell, delimiter);
+        block.row(filled).setZero();
+        size_t c = 0;
+        for (; c < ncols && getline(ss, cell, delimiter); ++c)
+            block(filled, c) = cell.empty() ? NAN : stod(cell);
+        if (c < ncols && striped[striped.size() - 1] == delimiter)
+            block(filled, c) = NAN;
+        filled++;
+        row++;
+        if (filled == static_cast<size_t>(block.rows()))
+            flush();
+    }
+    if (filled > 0)
+        flush();
+    if (input.bad()) {
+        std::cerr << "Error: could not read file " << filename << ", " << input.error() << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    file.close();
+    if (!file || std::rename(temporary.c_str(), binary.c_str()) != 0) {
+        std::cerr << "Error: could not write file " << binary << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    std::cout << "Data size: " << nrows << "x" << ncols << std::endl;
+    return true;
+}
+
+/**
+ * @brief Whether a binary matrix was converted from the current version of a text file,
+ *        the file has the size and modification time noted in the binary matrix
+ * 
+ * @param binary binary matrix file
+ * @param filename text matrix
+ * @return true 
+ * @return false if either file is missing or the text file changed since
+ */
+bool DataFrame::converted_from(const std::string &binary, const std::string &filename) {
+    std::ifstream file(binary, std::ios::binary);
+    DataFrame header;
+    uint32_t version;
+    uint64_t size;
+    int64_t mtime;
+    if (!file.is_open() || !header.read_header(file, version) || version < 3 || !fileStamp(filename, size, mtime)) {
+        return false;
+    }
+    return header.source_size == size && header.source_mtime == mtime;
+}
+
+/**
+ * @brief Load a sparse Matrix Market file. Files of 10x Genomics list the features as rows and the
+ *        cells as columns, they are transposed to samples x features. Feature and sample names are
+ *        the first field of features.tsv (or genes.tsv) and barcodes.tsv next to the file, if any.
+ * 
+ * @param filename 
+ * @return true 
+ * @return false 
+ */
+bool DataFrame::read_mtx(const std::string &filename) {
+    InputStream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: could not open file " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    if (!getline(file, line) || line.compare(0, 14, "%%MatrixMarket") != 0 || line.find("coordinate") == std::string::npos) {
+        std::cerr << "Error: " << filename << " is not a coordinate Matrix Market file." << std::endl;
+        return false;
+    }
+    bool pattern = line.find("pattern") != std::string::npos;
+    while (getline(file, line) && (line.empty() || line[0] == '%'));
+    size_t features, samples, entries;
+    if (!(stringstream(line) >> features >> samples >> entries)) {
+        std::cerr << "Error: invalid size line in " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Read data from file: " << filename << std::endl;
+    std::vector<Triplet<double> > triplets;
+    triplets.reserve(entries);
+    size_t feature, sample;
+    double value = 1;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '%') continue;
+        stringstream ss(line);
+        if (!(ss >> feature >> sample) || (!pattern && !(ss >> value)) ||
+            feature < 1 || feature > features || sample < 1 || sample > samples) {
+            std::cerr << "Error: invalid entry in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        if (value != 0)
+            triplets.emplace_back(sample - 1, feature - 1, value);
+    }
+    if (file.bad()) {
+        std::cerr << "Error: could not read file " << filename << ", " << file.error() << std::endl;
+        return false;
+    }
+    nrows = samples;
+    ncols = features;
+    this->sparse.resize(nrows, ncols);
+    this->sparse.setFromTriplets(triplets.begin(), triplets.end());
+    this->sparse.makeCompressed();
+    this->data.resize(0, 0);
+    sparseInput = true;
+
+    std::string dir = Utils::dirname(filename);
+    std::vector<std::string> names;
+    for (const char* list : {"/features.tsv", "/features.tsv.gz", "/genes.tsv", "/genes.tsv.gz"}) {
+        if (Utils::exists(dir + list)) {
+            names = readNames(dir + list);
+            break;
+        }
+    }
+    this->columns.resize(ncols);
+    for (size_t c = 0; c < ncols; ++c)
+        this->columns[c] = names.size() == ncols ? names[c] : std::to_string(c);
+    names.clear();
+    for (const char* list : {"/barcodes.tsv", "/barcodes.tsv.gz"}) {
+        if (Utils::exists(dir + list)) {
+            names = readNames(dir + list);
+            break;
+        }
+    }
+    this->index.resize(nrows);
+    for (size_t r = 0; r < nrows; ++r)
+        this->index[r] = names.size() == nrows ? names[r] : std::to_string(r);
+    std::cout << "Data size: " << nrows << "x" << ncols << ", " << this->sparse.nonZeros() << " non-zero values" << std::endl;
+    return true;
+}
+
+/**
+ * @brief Convert sparse values to the dense matrix, for the computations without a sparse kernel
+ * 
+ */
+void DataFrame::densify() {
+    if (!sparseInput) return;
+    this->data = MatrixXd(this->sparse);
+    this->sparse.resize(0, 0);
+    this->sparse.data().squeeze();
+    sparseInput = false;
+}
+
+/**
+ * @brief Values of the data, mapped or in memory
+ * 
+ * @return Map<const MatrixXd> 
+ */
+Map<const MatrixXd> DataFrame::view() const {
+    if (mapped != nullptr)
+        return Map<const MatrixXd>(mapped, nrows, ncols);
+    return Map<const MatrixXd>(this->data.data(), this->data.rows(), this->data.cols());
+}
+
+/**
+ * @brief Ask for the pages of some columns of a mapped matrix ahead of their use
+ * 
+ * @param first first column
+ * @param count number of columns
+ */
+void DataFrame::prefetch(Index first, Index count) const {
+    if (mapped == nullptr || count <= 0) return;
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(mapped + first * nrows) / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(mapped + (first + count) * nrows);
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
+/**
+ * @brief Drop the pages of some columns of a mapped matrix, they are read again from the file on use
+ * 
+ * @param first first column
+ * @param count number of columns
+ */
+void DataFrame::release(Index first, Index count) const {
+    if (mapped == nullptr || count <= 0) return;
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(mapped + first * nrows) / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(mapped + (first + count) * nrows);
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+}
+
 //
 ostream& operator<<(ostream& os, const DataFrame& df){
     os << "Matrix: " << df.index.size() << " X " << df.columns.size() << endl;
@@ -164,8 +562,51 @@ DataFrame operator/(DataFrame& df, const DataFrame& other) {
 }
 
 // private functions
+bool DataFrame::read_header(std::istream& file, uint32_t& version) {
+    char magic[4];
+    uint64_t rows, cols;
+    if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, MATRIX_MAGIC) ||
+        !Utils::readValue(file, version) || version < 1 || version > MATRIX_VERSION ||
+        !Utils::readValue(file, rows) || !Utils::readValue(file, cols) ||
+        (version >= 3 && (!Utils::readValue(file, source_size) || !Utils::readValue(file, source_mtime))) ||
+        !Utils::readString(file, this->index_name)) {
+        return false;
+    }
+    nrows = rows;
+    ncols = cols;
+    this->index.resize(nrows);
+    this->columns.resize(ncols);
+    for (auto& name : this->index) {
+        Utils::readString(file, name);
+        this->max_index_length = max(this->max_index_length, static_cast<int>(name.length()));
+    }
+    for (auto& name : this->columns) {
+        Utils::readString(file, name);
+        this->max_column_length = max(this->max_column_length, static_cast<int>(name.length()));
+    }
+    if (version >= 2)
+        file.ignore(padding(file.tellg()));
+    return static_cast<bool>(file);
+}
+
+void DataFrame::write_header(std::ostream& file) {
+    file.write(MATRIX_MAGIC, sizeof(MATRIX_MAGIC));
+    Utils::writeValue<uint32_t>(file, MATRIX_VERSION);
+    Utils::writeValue<uint64_t>(file, nrows);
+    Utils::writeValue<uint64_t>(file, ncols);
+    Utils::writeValue<uint64_t>(file, source_size);
+    Utils::writeValue<int64_t>(file, source_mtime);
+    Utils::writeString(file, this->index_name);
+    for (const auto& name : this->index)
+        Utils::writeString(file, name);
+    for (const auto& name : this->columns)
+        Utils::writeString(file, name);
+    const char zeros[sizeof(double)] = {0};
+    file.write(zeros, padding(file.tellp()));
+}
+
 bool DataFrame::getSize(const std::string& filename, const char delimiter) {
-    std::ifstream file(filename); // 打开文件流
+    InputStream file(filename); // 打开文件流
 
     if (!file.is_open()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
@@ -183,6 +624,10 @@ bool DataFrame::getSize(const std::string& filename, const char delimiter) {
         }
         ncols = std::max(ncols, temp_num_cols);
     }
+    if (file.bad()) {
+        std::cerr << "Error: could not read file " << filename << ", " << file.error() << std::endl;
+        return false;
+    }
     file.close();
     if (nrows * ncols > 0) {
         --nrows;
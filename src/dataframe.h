@@ -7,9 +7,12 @@
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 
 #include "utils.h"
+#include "stream.h"
 
 using namespace Eigen;
 using namespace std;
@@ -18,18 +21,29 @@ using namespace std;
 class DataFrame {
 public:
     MatrixXd data; // 数据矩阵
+    SparseMatrix<double> sparse;  // values of a Matrix Market file, `data` stays empty until densify()
     vector<string> index; // 行名
     vector<string> columns; // 列名
     string index_name = "index";
 private:
     size_t nrows = 0;
     size_t ncols = 0;
+    // text file a binary matrix was converted from, zero for none
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
 
     int max_column_length = -1;
     int max_index_length = this->index_name.length();
     char fill_char = ' ';
 
     bool getSize(const string& filename, const char delimiter);
+    bool read_header(std::istream& file, uint32_t& version);
+    void write_header(std::ostream& file);
+
+    // values of a memory-mapped binary matrix, `data` stays empty
+    std::shared_ptr<const void> mapping;
+    const double* mapped = nullptr;
+    bool sparseInput = false;
 
 public:
     DataFrame();
@@ -38,6 +52,21 @@ public:
     // 从文件中读取数据
     bool read_csv(const string& filename, const char delimiter=',', bool header=true, bool index=true);
     bool to_csv(const string& filename, const char delimiter=',', bool header=true, bool index=true);
+    // binary matrix (.gpm): names followed by the column-major values
+    bool read_binary(const string& filename);
+    bool to_binary(const string& filename);
+    // Matrix Market file (features x samples, 10x layout), names from features.tsv / barcodes.tsv
+    bool read_mtx(const string& filename);
+    bool is_sparse() const { return sparseInput; }
+    void densify();
+    // keep the values of a binary matrix on disk, column blocks are paged in on use
+    bool map_binary(const string& filename);
+    bool convert_binary(const string& filename, const string& binary, size_t memory);
+    static bool converted_from(const string& binary, const string& filename);
+    bool is_mapped() const { return mapped != nullptr; }
+    Map<const MatrixXd> view() const;
+    void prefetch(Index first, Index count) const;
+    void release(Index first, Index count) const;
     // 运算符重载
     friend ostream& operator<<(ostream& os, const DataFrame& df);
     friend DataFrame operator+(DataFrame& df, const DataFrame& other);
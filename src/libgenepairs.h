@@ -0,0 +1,30 @@
+#ifndef LIBGENEPAIRS_H
+#define LIBGENEPAIRS_H
+
+/**
+ * Public header of libgenepairs (`make lib`).
+ *
+ * The engines run over in-memory matrices (samples x features, column-major) without
+ * copying them, results are either kept in `pairs` or delivered in batches to a sink:
+ *
+ *     Map<const MatrixXd> expr(buffer, samples, features);
+ *     CorrOptions opts;
+ *     opts.method = "pearson";
+ *     opts.analysis = "common";
+ *     opts.threshold = 0.5;
+ *     CorrPairs engine(opts, expr);
+ *     engine.setSink([](const PairStore& batch) {
+ *         for (size_t r = 0; r < batch.size(); ++r)
+ *             consume(batch.key(r, 0), batch.key(r, 1), batch.real(r, 0));
+ *     });
+ *     engine.getPairs();
+ *
+ * The sink is called by one thread at a time, feature names (if set in `columns`)
+ * are available from the engine.
+ */
+
+#include "pairstore.h"
+#include "corrpairs.h"
+#include "stablepairs.h"
+
+#endif
@@ -1,12 +1,288 @@
 #include <map>
+#include <memory>
+#include <cstdlib>
 #include <iostream>
 
 #include <CLI/CLI.hpp>
 #include <CLI/Validators.hpp>
 
 #include "utils.h"
+#include "stream.h"
+#include "pairstore.h"
 #include "corrpairs.h"
 #include "stablepairs.h"
+#include "server.h"
+#include "suffstats.h"
+#include "metrics.h"
+
+
+namespace {
+    /**
+     * @brief Subcommand and options of stable pairs
+     *
+     * @param app
+     * @param opt
+     * @return the subcommand
+     */
+    CLI::App* addStable(CLI::App& app, StableOptions& opt) {
+        CLI::App *stable_pairs = app.add_subcommand("stable", "Find feature pairs that have a stable relationship in one type of sample and a reversed relationship in another type of sample.");
+        stable_pairs->add_option("-i,--input", opt.expression, "Feature data file.")->check(CLI::ExistingFile)->required(true);
+        CLI::Option *stable_target = stable_pairs->add_option("-t,--target", opt.target, "Other features data file.")->check(CLI::ExistingFile);
+        stable_pairs->add_option("-g,--groups", opt.groups, "Sample group file (sample, group), find pairs stable in some groups and reversed in others.")->check(CLI::ExistingFile)->excludes(stable_target);
+        stable_pairs->add_option("-o,--output", opt.output, "Output filename.");
+        stable_pairs->add_option("--features", opt.features, "File of selected features (one per line), only pairs involving them are searched.")->check(CLI::ExistingFile);
+        stable_pairs->add_option("--ratio", opt.ratio, "The ratio of feature a > feature b in all samples.")->default_val(0.9);
+        stable_pairs->add_option("--revRatio", opt.revRatio, "The ratio of feature a < feature b in another samples.")->default_val(0.7);
+        stable_pairs->add_option("--threads", opt.threads, "Number of threads used.")->default_val(2);
+        stable_pairs->add_option("--block", opt.block, "Data blocks processed by each thread, defaults to the size of the column.");
+        stable_pairs->add_option("--save-stats", opt.stats, "Save the sufficient statistics of the candidate pairs for the update subcommand.");
+        stable_pairs->add_option("--stats-slack", opt.slack, "Candidate pairs pass the ratios lowered by this value.")->default_val(0.1);
+        stable_pairs->add_option("--bootstrap", opt.bootstrap, "Bootstrap resamples of the samples, write the selection frequency of each stable pair.");
+        stable_pairs->add_option("--min-frequency", opt.minFrequency, "Lowest selection frequency of the pairs written with --bootstrap.")->default_val(0.0);
+        stable_pairs->add_flag("--summary", opt.summary, "Only write the histograms of the ratios and the pairs of each feature, not the pairs.");
+        stable_pairs->add_flag("--plan", opt.plan, "Only estimate the pairs, hit rate, output size, memory and runtime of the run from a sample of pairs.");
+        stable_pairs->add_flag("--sort", opt.sort, "Sort pairs by feature, sorted .gpb output is indexed by the first feature.");
+        CLI::Option *stable_numa = stable_pairs->add_flag("--numa", opt.numa, "Pin threads to NUMA nodes and keep a copy of the data on each node.");
+        stable_pairs->add_option("--memory-limit", opt.memoryLimit, "Keep the data on disk and stream column blocks through this many MB of memory.")->excludes(stable_numa);
+        stable_pairs->add_option("--cache-dir", opt.cacheDir, "Directory of the binary matrices converted for --memory-limit, next to the data files by default.");
+        // 当出现的参数子命令解析不了时,返回上一级尝试解析
+        stable_pairs->fallthrough();
+        return stable_pairs;
+    }
+
+    /**
+     * @brief Subcommand and options of correlation pairs
+     *
+     * @param app
+     * @param opt
+     * @return the subcommand
+     */
+    CLI::App* addCorr(CLI::App& app, CorrOptions& opt) {
+        CLI::App *corr_pairs = app.add_subcommand("corr", "Find feature pairs whose expression relationships (addition, subtraction, multiplication, division) are highly correlated with other features.");
+        CLI::Option *corr_input = corr_pairs->add_option("-i,--input", opt.expression, "Feature data file.")->check(CLI::ExistingFile);
+        corr_pairs->add_option("-t,--target", opt.target, "Other features data file.")->check(CLI::ExistingFile);
+        corr_pairs->add_option("-o,--output", opt.output, "Output filename.");
+        corr_pairs->add_option("--features", opt.features, "File of selected features (one per line), only pairs whose first feature is selected are searched.")->check(CLI::ExistingFile);
+        corr_pairs->add_option("--targets", opt.targets, "File of selected target features (one per line).")->check(CLI::ExistingFile);
+        corr_pairs->add_option("-m,--method", opt.method, "Correlation method, pearson/spearman/kendall.")->default_val("pearson");
+        corr_pairs->add_option("-a,--operation", opt.operation, "Operations(add/subtract/multiply/divide) between features, a comma separated list or all in pairs mode.")->default_val("subtract");
+        corr_pairs->add_option("--type", opt.analysis, "Analysis type, common/cross/pairs.")->default_val("common");
+        corr_pairs->add_option("--cutoff", opt.threshold, "Correlation coefficient threshold.")->default_val(0.3);
+        corr_pairs->add_option("--threads", opt.threads, "Number of threads used.")->default_val(2);
+        corr_pairs->add_option("--block", opt.block, "Data blocks processed by each thread, defaults to the size of the column.");
+        corr_pairs->add_option("--covariates", opt.covariates, "Sample covariates (sample, covariates...) regressed out of the feature and other features data, partial correlations.")->check(CLI::ExistingFile);
+        corr_pairs->add_option("--sketch", opt.sketch, "Screen common pairs with a sketch of this rank before the exact computation, the pairs found are the same.");
+        corr_pairs->add_option("--run-dir", opt.runDir, "Directory keeping the source data of a cross/pairs run for --append-targets.");
+        corr_pairs->add_option("--append-targets", opt.appendTargets, "Compute only the new target features of this file against the run directory.")->check(CLI::ExistingFile)->excludes(corr_input);
+        corr_pairs->add_option("--save-stats", opt.stats, "Save the sufficient statistics of the candidate pairs for the update subcommand (pearson).");
+        corr_pairs->add_option("--stats-slack", opt.slack, "Candidate pairs pass the cutoff lowered by this value.")->default_val(0.1);
+        corr_pairs->add_flag("--summary", opt.summary, "Only write the histograms of the correlations and the pairs of each feature, not the pairs.");
+        corr_pairs->add_flag("--plan", opt.plan, "Only estimate the pairs, hit rate, output size, memory and runtime of the run from a sample of pairs.");
+        corr_pairs->add_flag("--sort", opt.sort, "Sort pairs by feature, sorted .gpb output is indexed by the first feature.");
+        CLI::Option *corr_numa = corr_pairs->add_flag("--numa", opt.numa, "Pin threads to NUMA nodes and keep a copy of the data on each node.");
+        corr_pairs->add_option("--memory-limit", opt.memoryLimit, "Keep the feature data on disk and stream column blocks through this many MB of memory.")->excludes(corr_numa);
+        corr_pairs->add_option("--cache-dir", opt.cacheDir, "Directory of the binary matrices converted for --memory-limit, next to the data files by default.");
+        corr_pairs->fallthrough();
+        return corr_pairs;
+    }
+
+    /**
+     * @brief Read a data file once for all the analyses of a run
+     *
+     * @param frames loaded files
+     * @param filename
+     * @return the data
+     */
+    DataFrame* loadFrame(std::map<std::string, std::unique_ptr<DataFrame> >& frames, const std::string& filename) {
+        auto it = frames.find(filename);
+        if (it == frames.end()) {
+            Metrics::Phase phase("load");
+            it = frames.emplace(filename, std::unique_ptr<DataFrame>(new DataFrame(filename))).first;
+        }
+        return it->second.get();
+    }
+
+    /**
+     * @brief Split a job into its arguments like a shell: blanks separate the arguments, single
+     *        quotes keep everything up to the next one, double quotes keep everything but \" and \\,
+     *        and a backslash outside quotes keeps the next character
+     *
+     * @param job
+     * @param args
+     * @return false for an unterminated quote
+     */
+    bool splitArgs(const std::string& job, std::vector<std::string>& args) {
+        std::string arg;
+        bool open = false;    // an argument was started, it may be empty ("")
+        char quote = 0;
+        for (size_t c = 0; c < job.size(); ++c) {
+            char ch = job[c];
+            if (quote == '\'') {
+                if (ch == '\'') quote = 0;
+                else arg += ch;
+            } else if (quote == '"') {
+                if (ch == '"') quote = 0;
+                else if (ch == '\\' && c + 1 < job.size() && (job[c + 1] == '"' || job[c + 1] == '\\')) arg += job[++c];
+                else arg += ch;
+            } else if (ch == '\'' || ch == '"') {
+                quote = ch;
+                open = true;
+            } else if (ch == '\\' && c + 1 < job.size()) {
+                arg += job[++c];
+                open = true;
+            } else if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') {
+                if (open) args.push_back(arg);
+                arg.clear();
+                open = false;
+            } else {
+                arg += ch;
+                open = true;
+            }
+        }
+        if (open) args.push_back(arg);
+        return quote == 0;
+    }
+
+    // an analysis of a run, with the options of its subcommand
+    struct Job {
+        std::string text;
+        bool stable = false;
+        StableOptions stableopt;
+        CorrOptions corropt;
+        bool done = false;   // computed with an earlier analysis
+    };
+
+    /**
+     * @brief Parse the arguments of an analysis with the options of the stable and corr commands
+     *
+     * @param text arguments of a stable or corr command
+     * @param job
+     * @return true
+     * @return false
+     */
+    bool parseJob(const std::string& text, Job& job) {
+        std::vector<std::string> args = {"run"};
+        if (!splitArgs(text, args)) {
+            std::cerr << "[Run] - Invalid analysis \"" << text << "\": unterminated quote." << std::endl;
+            return false;
+        }
+        std::vector<char*> argv;
+        for (std::string& arg : args)
+            argv.push_back(&arg[0]);
+        CLI::App jobApp("job");
+        jobApp.require_subcommand(1);
+        CLI::App* stable_pairs = addStable(jobApp, job.stableopt);
+        addCorr(jobApp, job.corropt);
+        try {
+            jobApp.parse(static_cast<int>(argv.size()), argv.data());
+        } catch (const CLI::Error& e) {
+            std::cerr << "[Run] - Invalid analysis \"" << text << "\": " << e.what() << std::endl;
+            return false;
+        }
+        job.text = Utils::strip(text);
+        job.stable = stable_pairs->parsed();
+        return true;
+    }
+
+    /**
+     * @brief Whether a correlation shares the loaded data with the other analyses: covariates change
+     *        the data and the others read their own files
+     */
+    bool sharesData(const CorrOptions& opt) {
+        return opt.covariates.empty() && opt.appendTargets.empty() && opt.memoryLimit == 0;
+    }
+
+    /**
+     * @brief Run several stable/corr analyses in one process. Every data file is read once and
+     *        shared by the analyses, the standardized columns of a correlation are kept for the
+     *        next correlations of the same data and method. The pearson and spearman correlations
+     *        of the common pairs of the same data are computed in one traversal of the pairs,
+     *        stable pairs and cross or pairs correlations keep their own traversal.
+     *
+     * @param texts analyses, the arguments of a stable or corr command, quoted as in a shell
+     * @return true
+     * @return false
+     */
+    bool runAnalyses(const std::vector<std::string>& texts) {
+        std::vector<Job> jobs(texts.size());
+        for (size_t n = 0; n < texts.size(); ++n)
+            if (!parseJob(texts[n], jobs[n])) return false;
+        std::map<std::string, std::unique_ptr<DataFrame> > frames;
+        std::map<std::string, ColumnStats> standardized;
+        for (size_t n = 0; n < jobs.size(); ++n) {
+            if (jobs[n].done) continue;
+            std::cout << "[Run] - Analysis " << n + 1 << "/" << jobs.size() << ": " << jobs[n].text << std::endl;
+            Metrics::Phase phase("job " + std::to_string(n + 1));
+            try {
+                if (jobs[n].stable) {
+                    const StableOptions& stableopt = jobs[n].stableopt;
+                    std::unique_ptr<StablePairs> sp;
+                    if (stableopt.memoryLimit > 0) {
+                        // mapped data is read by the analysis itself
+                        sp.reset(new StablePairs(stableopt));
+                    } else {
+                        DataFrame* target = stableopt.groups.empty() && !stableopt.target.empty() ? loadFrame(frames, stableopt.target) : nullptr;
+                        sp.reset(new StablePairs(stableopt, loadFrame(frames, stableopt.expression), target));
+                    }
+                    if (stableopt.plan ? !sp->plan() : !sp->getPairs() || !sp->writePairs())
+                        return false;
+                    continue;
+                }
+                const CorrOptions& corropt = jobs[n].corropt;
+                if (corropt.expression.empty() == corropt.appendTargets.empty() || (!corropt.appendTargets.empty() && corropt.runDir.empty())) {
+                    std::cerr << "[Run] - Give either --input, or --append-targets with --run-dir." << std::endl;
+                    return false;
+                }
+                if (!sharesData(corropt)) {
+                    CorrPairs cp(corropt);
+                    if (corropt.plan ? !cp.plan() : !cp.getPairs() || !cp.writePairs())
+                        return false;
+                    continue;
+                }
+                DataFrame* target = corropt.target.empty() ? nullptr : loadFrame(frames, corropt.target);
+                std::unique_ptr<CorrPairs> cp(new CorrPairs(corropt, loadFrame(frames, corropt.expression), target));
+                // the later correlations of the common pairs of the same data share the traversal
+                std::vector<std::unique_ptr<CorrPairs> > partners;
+                for (size_t m = n + 1; m < jobs.size() && target == nullptr; ++m) {
+                    const CorrOptions& opt = jobs[m].corropt;
+                    if (jobs[m].stable || jobs[m].done || !sharesData(opt) || !opt.target.empty() ||
+                        opt.expression != corropt.expression || opt.features != corropt.features)
+                        continue;
+                    std::unique_ptr<CorrPairs> partner(new CorrPairs(opt, loadFrame(frames, opt.expression), nullptr));
+                    if (!cp->fusable(*partner)) continue;
+                    jobs[m].done = true;
+                    std::cout << "[Run] - Analysis " << m + 1 << "/" << jobs.size() << " shares the traversal: " << jobs[m].text << std::endl;
+                    partners.push_back(std::move(partner));
+                }
+                std::vector<CorrPairs*> engines = {cp.get()}, others;
+                for (const auto& partner : partners)
+                    others.push_back(partner.get());
+                engines.insert(engines.end(), others.begin(), others.end());
+                // the standardized columns only depend on the data and the method
+                for (CorrPairs* engine : engines) {
+                    auto it = standardized.find(engine->options.expression + "\t" + engine->options.method);
+                    if (it != standardized.end())
+                        engine->sourceStats = std::move(it->second);
+                }
+                if (!others.empty()) {
+                    if (!cp->getPairsWith(others)) return false;
+                    for (CorrPairs* engine : engines)
+                        if (!engine->writePairs()) return false;
+                } else if (corropt.plan ? !cp->plan() : !cp->getPairs() || !cp->writePairs()) {
+                    return false;
+                }
+                for (CorrPairs* engine : engines) {
+                    if (!engine->sourceStats.empty())
+                        standardized[engine->options.expression + "\t" + engine->options.method] = std::move(engine->sourceStats);
+                }
+            } catch (const std::invalid_argument& e) {
+                std::cerr << "[Run] - " << e.what() << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
 
 
 int main(int argc, char* argv[]) {
@@ -22,39 +298,80 @@ int main(int argc, char* argv[]) {
     CLI::App app("program:" + std::string(argv[0]) + "\n");
     app.get_formatter()->column_width(40);
     app.require_subcommand(1);   // 表示运行命令需要且仅需要一个子命令
+    std::string metricsFile;
+    bool perfCounters = false;
+    app.add_option("--metrics", metricsFile, "Write phase timings, pair counters, thread busy time and peak memory of the run to this JSON file.");
+    app.add_flag("--perf", perfCounters, "Read the hardware counters (cycles, instructions, LLC and branch misses) of the compute phases (Linux).");
 
     // stable
-    StableOptions *stableopt = new StableOptions();
-    CLI::App *stable_pairs = app.add_subcommand("stable", "Find feature pairs that have a stable relationship in one type of sample and a reversed relationship in another type of sample.");
-    stable_pairs->add_option("-i,--input", stableopt->expression, "Feature data file.")->check(CLI::ExistingFile)->required(true);
-    stable_pairs->add_option("-t,--target", stableopt->target, "Other features data file.")->check(CLI::ExistingFile);
-    stable_pairs->add_option("-o,--output", stableopt->output, "Output filename.");
-    stable_pairs->add_option("--ratio", stableopt->ratio, "The ratio of feature a > feature b in all samples.")->default_val(0.9);
-    stable_pairs->add_option("--revRatio", stableopt->revRatio, "The ratio of feature a < feature b in another samples.")->default_val(0.7);
-    stable_pairs->add_option("--threads", stableopt->threads, "Number of threads used.")->default_val(2);
-    stable_pairs->add_option("--block", stableopt->block, "Data blocks processed by each thread, defaults to the size of the column.");
-    // 当出现的参数子命令解析不了时,返回上一级尝试解析
-    stable_pairs->fallthrough();
+    StableOptions stableopt;
+    CLI::App *stable_pairs = addStable(app, stableopt);
     // correlation
-    CorrOptions *corropt = new CorrOptions();
-    CLI::App *corr_pairs = app.add_subcommand("corr", "Find feature pairs whose expression relationships (addition, subtraction, multiplication, division) are highly correlated with other features.");
-    corr_pairs->add_option("-i,--input", corropt->expression, "Feature data file.")->check(CLI::ExistingFile)->required(true);
-    corr_pairs->add_option("-t,--target", corropt->target, "Other features data file.")->check(CLI::ExistingFile);
-    corr_pairs->add_option("-o,--output", corropt->output, "Output filename.");
-    corr_pairs->add_option("-m,--method", corropt->method, "Correlation method, pearson/spearman/kendall.")->default_val("pearson");
-    corr_pairs->add_option("-a,--operation", corropt->operation, "Operations(add/subtract/multiply/divide) between features.")->default_val("subtract");
-    corr_pairs->add_option("--type", corropt->analysis, "Analysis type, common/cross/pairs.")->default_val("common");
-    corr_pairs->add_option("--cutoff", corropt->threshold, "Correlation coefficient threshold.")->default_val(0.3);
-    corr_pairs->add_option("--threads", corropt->threads, "Number of threads used.")->default_val(2);
-    corr_pairs->add_option("--block", corropt->block, "Data blocks processed by each thread, defaults to the size of the column.");
-    corr_pairs->fallthrough();
+    CorrOptions corropt;
+    CLI::App *corr_pairs = addCorr(app, corropt);
+    // run
+    std::vector<std::string> runJob;
+    std::string runJobs;
+    CLI::App *run_pairs = app.add_subcommand("run", "Run several stable/corr analyses, every data file is read once for all of them.");
+    run_pairs->add_option("-j,--job", runJob, "An analysis, the arguments of a stable or corr command (eg. \"corr -i exp.txt -m spearman -o sp.txt\"), repeated.");
+    run_pairs->add_option("--jobs", runJobs, "File of analyses, one per line.")->check(CLI::ExistingFile);
+    run_pairs->fallthrough();
+    // view
+    std::string viewInput, viewOutput, viewFeature;
+    CLI::App *view_pairs = app.add_subcommand("view", "Export a binary pair file (.gpb) to text.");
+    view_pairs->add_option("-i,--input", viewInput, "Binary pair file.")->check(CLI::ExistingFile)->required(true);
+    view_pairs->add_option("-o,--output", viewOutput, "Output filename, defaults to standard output.");
+    view_pairs->add_option("-f,--feature", viewFeature, "Only export pairs whose first feature is this one (needs a sorted file).");
+    view_pairs->fallthrough();
+    // update
+    std::string updateStats, updateInput, updateTarget, updateOutput, updateSave;
+    size_t updateThreads = 2;
+    bool updateInPlace = false;
+    CLI::App *update_pairs = app.add_subcommand("update", "Fold new samples into the sufficient statistics of a previous run.");
+    update_pairs->add_option("-s,--stats", updateStats, "Statistics file saved with --save-stats.")->check(CLI::ExistingFile)->required(true);
+    update_pairs->add_option("-i,--input", updateInput, "New samples of the feature data.")->check(CLI::ExistingFile);
+    update_pairs->add_option("-t,--target", updateTarget, "New samples of the other features data.")->check(CLI::ExistingFile);
+    update_pairs->add_option("-o,--output", updateOutput, "Output filename.")->required(true);
+    CLI::Option* updateSaveOption = update_pairs->add_option("--save-stats", updateSave, "Save the updated statistics.");
+    update_pairs->add_flag("--in-place", updateInPlace, "Overwrite the input statistics with the updated statistics.")->excludes(updateSaveOption);
+    update_pairs->add_option("--threads", updateThreads, "Number of threads used.")->default_val(2);
+    update_pairs->fallthrough();
+    // serve
+    ServeOptions serveopt;
+    CLI::App *serve_pairs = app.add_subcommand("serve", "Keep the data loaded and answer pair queries on a Unix socket.");
+    serve_pairs->add_option("-i,--input", serveopt.expression, "Feature data file.")->check(CLI::ExistingFile)->required(true);
+    serve_pairs->add_option("-t,--target", serveopt.target, "Other features data file.")->check(CLI::ExistingFile);
+    serve_pairs->add_option("-s,--socket", serveopt.socket, "Unix socket path.")->default_val("gene_pairs.sock");
+    serve_pairs->add_option("-m,--method", serveopt.method, "Correlation method, pearson/spearman/kendall.")->default_val("pearson");
+    serve_pairs->add_option("-a,--operation", serveopt.operation, "Operations(add/subtract/multiply/divide) between features.")->default_val("subtract");
+    serve_pairs->add_option("--cutoff", serveopt.threshold, "Default correlation coefficient threshold.")->default_val(0.3);
+    serve_pairs->add_option("--ratio", serveopt.ratio, "Default ratio of feature a > feature b in all samples.")->default_val(0.9);
+    serve_pairs->add_option("--threads", serveopt.threads, "Number of threads used.")->default_val(2);
+    serve_pairs->add_option("--timeout", serveopt.timeout, "Seconds before an idle client is disconnected, 0 for no limit.")->default_val(60);
+    serve_pairs->fallthrough();
 
     CLI11_PARSE(app, argc, argv);
+    if (!metricsFile.empty() || perfCounters) {
+        std::string command = argv[0];
+        for (int i = 1; i < argc; ++i)
+            command += std::string(" ") + argv[i];
+        Metrics::global().enable(metricsFile, command, perfCounters);
+        // written on every way out of main
+        std::atexit([] { Metrics::global().write(); });
+    }
     // stable
     if (stable_pairs->parsed()) {
         std::cout << "[Stable Pairs] - Begin at: " << Utils::currentTime() << std::endl;
-        StablePairs* sp = new StablePairs(stableopt);
-        if (sp->getPairs()) {
+        StablePairs* sp;
+        try {
+            sp = new StablePairs(stableopt);
+        } catch (const std::invalid_argument& e) {
+            std::cerr << "[Stable Pairs] - " << e.what() << std::endl;
+            return 1;
+        }
+        if (stableopt.plan) {
+            sp->plan();
+        } else if (sp->getPairs()) {
             sp->writePairs();
         } else {
             std::cout << "Stable Pairs] - Stable gene pair calculation error!\n";
@@ -64,9 +381,21 @@ int main(int argc, char* argv[]) {
     }
     // corr
     if (corr_pairs->parsed()) {
+        if (corropt.expression.empty() == corropt.appendTargets.empty() || (!corropt.appendTargets.empty() && corropt.runDir.empty())) {
+            std::cerr << "[Correlation Pairs] - Give either --input, or --append-targets with --run-dir." << std::endl;
+            return 1;
+        }
         std::cout << "[Correlation Pairs] - Begin at: " << Utils::currentTime() << std::endl;
-        CorrPairs* cp = new CorrPairs(corropt);
-        if (cp->getPairs()) {
+        CorrPairs* cp;
+        try {
+            cp = new CorrPairs(corropt);
+        } catch (const std::invalid_argument& e) {
+            std::cerr << "[Correlation Pairs] - " << e.what() << std::endl;
+            return 1;
+        }
+        if (corropt.plan) {
+            cp->plan();
+        } else if (cp->getPairs()) {
             cp->writePairs();
         } else {
             std::cout << "[[Correlation Pairs] - Correlation gene pair calculation error!\n";
@@ -74,4 +403,103 @@ int main(int argc, char* argv[]) {
         std::cout << "[Correlation Pairs] - End at: " << Utils::currentTime() << std::endl;
         delete cp;
     }
+    // run
+    if (run_pairs->parsed()) {
+        std::vector<std::string> jobs = runJob;
+        if (!runJobs.empty()) {
+            InputStream jobFile(runJobs);
+            std::string line;
+            while (std::getline(jobFile, line)) {
+                line = Utils::strip(line);
+                if (!line.empty() && line[0] != '#')
+                    jobs.push_back(line);
+            }
+        }
+        if (jobs.empty()) {
+            std::cerr << "[Run] - Give the analyses with --job or --jobs." << std::endl;
+            return 1;
+        }
+        std::cout << "[Run] - Begin at: " << Utils::currentTime() << std::endl;
+        if (!runAnalyses(jobs)) {
+            return 1;
+        }
+        std::cout << "[Run] - End at: " << Utils::currentTime() << std::endl;
+    }
+    // update
+    if (update_pairs->parsed()) {
+        std::cout << "[Update] - Begin at: " << Utils::currentTime() << std::endl;
+        SuffStats stats;
+        if (!stats.load(updateStats)) {
+            return 1;
+        }
+        std::unique_ptr<DataFrame> source, target;
+        if (!updateInput.empty()) {
+            source.reset(new DataFrame(updateInput));
+            source->densify();
+        }
+        if (!updateTarget.empty()) {
+            target.reset(new DataFrame(updateTarget));
+            target->densify();
+        }
+        if (!stats.update(source.get(), target.get(), updateThreads)) {
+            return 1;
+        }
+        PairStore pairs;
+        stats.results(pairs);
+        std::cout << "[Update] - Total number of gene pairs: " << pairs.size() << std::endl;
+        bool success;
+        if (Utils::endsWith(updateOutput, ".gpb")) {
+            pairs.sort();
+            success = pairs.save(updateOutput);
+        } else {
+            OutputStream outputFile(updateOutput, updateThreads);
+            success = outputFile.is_open();
+            if (success) {
+                pairs.write(outputFile, Utils::getDelim(updateOutput), true, updateThreads);
+                success = outputFile.close();
+            }
+        }
+        if (!success) {
+            std::cerr << "[Update] - Failed to write " << updateOutput << std::endl;
+            return 1;
+        }
+        // the statistics are only replaced once the pairs are written
+        if (updateInPlace)
+            updateSave = updateStats;
+        if (updateSave.empty()) {
+            std::cout << "[Update] - The updated statistics are not saved, give --save-stats or --in-place to keep them." << std::endl;
+        } else if (!stats.save(updateSave)) {
+            return 1;
+        } else {
+            std::cout << "[Update] - Saved the updated statistics to " << updateSave << std::endl;
+        }
+        std::cout << "[Update] - End at: " << Utils::currentTime() << std::endl;
+    }
+    // serve
+    if (serve_pairs->parsed()) {
+        std::cout << "[Serve] - Begin at: " << Utils::currentTime() << std::endl;
+        Server server(serveopt);
+        if (!server.run()) {
+            return 1;
+        }
+        std::cout << "[Serve] - End at: " << Utils::currentTime() << std::endl;
+    }
+    // view
+    if (view_pairs->parsed()) {
+        PairStore store;
+        bool success = viewFeature.empty() ? store.load(viewInput) : store.load(viewInput, viewFeature);
+        if (!success) {
+            return 1;
+        }
+        if (viewOutput.empty()) {
+            store.write(std::cout, '\t');
+        } else {
+            OutputStream outputFile(viewOutput);
+            if (!outputFile.is_open()) {
+                std::cerr << "[View Pairs] - Failed to open file." << std::endl;
+                return 1;
+            }
+            store.write(outputFile, Utils::getDelim(viewOutput));
+        }
+    }
 }
\ No newline at end of file
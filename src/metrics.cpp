@@ -0,0 +1,359 @@
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "metrics.h"
+
+namespace {
+    std::string quote(const std::string& str) {
+        std::ostringstream os;
+        os << '"';
+        for (char c : str) {
+            switch (c) {
+                case '"': os << "\\\""; break;
+                case '\\': os << "\\\\"; break;
+                case '\n': os << "\\n"; break;
+                case '\t': os << "\\t"; break;
+                case '\r': os << "\\r"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                        os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+                    else
+                        os << c;
+            }
+        }
+        os << '"';
+        return os.str();
+    }
+
+    void indent(std::ostream& os, int depth) {
+        os << std::string(2 * depth, ' ');
+    }
+
+    /**
+     * @brief Hardware counters of a phase per pair it evaluated
+     *
+     * @param node
+     * @return names and values, empty without hardware counters or pairs
+     */
+    template <typename NodeT>
+    std::vector<std::pair<std::string, double> > perPair(const NodeT& node) {
+        std::vector<std::pair<std::string, double> > ratios;
+        uint64_t pairs = 0;
+        for (const auto& c : node.counters)
+            if (c.first == "pairs_evaluated") pairs = c.second;
+        if (pairs == 0) return ratios;
+        for (const char* name : PerfCounters::NAMES) {
+            for (const auto& c : node.counters)
+                if (c.first == name) ratios.emplace_back(c.first, 1.0 * c.second / pairs);
+        }
+        return ratios;
+    }
+
+    template <typename NodeT>
+    double instructionsPerCycle(const NodeT& node) {
+        uint64_t cycles = 0, instructions = 0;
+        for (const auto& c : node.counters) {
+            if (c.first == "cycles") cycles = c.second;
+            if (c.first == "instructions") instructions = c.second;
+        }
+        return cycles > 0 ? 1.0 * instructions / cycles : 0;
+    }
+
+    template <typename NodeT>
+    void total(const NodeT& node, std::map<std::string, uint64_t>& sums, std::vector<std::string>& names) {
+        for (const auto& c : node.counters) {
+            if (sums.find(c.first) == sums.end())
+                names.push_back(c.first);
+            sums[c.first] += c.second;
+        }
+        for (const auto& child : node.children)
+            total(*child, sums, names);
+    }
+
+    template <typename NodeT>
+    void writeNode(std::ostream& os, const NodeT& node, int depth) {
+        std::vector<std::pair<std::string, double> > ratios = perPair(node);
+        double ipc = instructionsPerCycle(node);
+        indent(os, depth);
+        os << "{\n";
+        indent(os, depth + 1);
+        os << "\"name\": " << quote(node.name) << ",\n";
+        indent(os, depth + 1);
+        os << "\"calls\": " << node.calls << ",\n";
+        indent(os, depth + 1);
+        os << "\"nanoseconds\": " << node.nanoseconds << ",\n";
+        indent(os, depth + 1);
+        os << "\"seconds\": " << std::setprecision(9) << node.nanoseconds * 1e-9 << ",\n";
+        indent(os, depth + 1);
+        os << "\"peak_rss_bytes\": " << node.peakMemory;
+        if (!node.counters.empty()) {
+            os << ",\n";
+            indent(os, depth + 1);
+            os << "\"counters\": {";
+            for (size_t c = 0; c < node.counters.size(); ++c)
+                os << (c > 0 ? ", " : "") << quote(node.counters[c].first) << ": " << node.counters[c].second;
+            os << "}";
+        }
+        if (!ratios.empty()) {
+            os << ",\n";
+            indent(os, depth + 1);
+            os << "\"per_pair\": {";
+            for (size_t r = 0; r < ratios.size(); ++r)
+                os << (r > 0 ? ", " : "") << quote(ratios[r].first) << ": " << std::setprecision(6) << ratios[r].second;
+            os << "}";
+        }
+        if (ipc > 0) {
+            os << ",\n";
+            indent(os, depth + 1);
+            os << "\"instructions_per_cycle\": " << std::setprecision(4) << ipc;
+        }
+        if (!node.busy.empty()) {
+            os << ",\n";
+            indent(os, depth + 1);
+            os << "\"thread_busy_seconds\": [";
+            for (size_t t = 0; t < node.busy.size(); ++t)
+                os << (t > 0 ? ", " : "") << std::setprecision(6) << node.busy[t];
+            os << "]";
+        }
+        if (!node.children.empty()) {
+            os << ",\n";
+            indent(os, depth + 1);
+            os << "\"phases\": [\n";
+            for (size_t c = 0; c < node.children.size(); ++c) {
+                writeNode(os, *node.children[c], depth + 2);
+                os << (c + 1 < node.children.size() ? ",\n" : "\n");
+            }
+            indent(os, depth + 1);
+            os << "]";
+        }
+        os << "\n";
+        indent(os, depth);
+        os << "}";
+    }
+}
+
+Metrics::Metrics() {}
+
+/**
+ * @brief Metrics of the process
+ *
+ * @return Metrics&
+ */
+Metrics& Metrics::global() {
+    static Metrics metrics;
+    return metrics;
+}
+
+/**
+ * @brief Start recording, the root phase is the whole command
+ *
+ * @param file JSON file written by write(), empty to only print the hardware counters
+ * @param cmd command line of the process
+ * @param counters read the hardware counters of the phases given their threads
+ */
+void Metrics::enable(const std::string& file, const std::string& cmd, bool counters) {
+    on = true;
+    hardware = counters;
+    warned = false;
+    filename = file;
+    command = cmd;
+    root = Node();
+    root.name = "total";
+    root.calls = 1;
+    open.assign(1, &root);
+}
+
+/**
+ * @brief Open a phase under the innermost open phase
+ *
+ * @param name
+ * @param threads threads of the kernels of the phase, their hardware counters are read
+ */
+void Metrics::begin(const std::string& name, size_t threads) {
+    if (!on) return;
+    Node* parent = open.back();
+    Node* node = nullptr;
+    for (const std::unique_ptr<Node>& child : parent->children) {
+        if (child->name == name) {
+            node = child.get();
+            break;
+        }
+    }
+    if (node == nullptr) {
+        parent->children.emplace_back(new Node());
+        node = parent->children.back().get();
+        node->name = name;
+    }
+    node->calls++;
+    if (hardware && threads > 0) {
+        node->perf.reset(new PerfCounters());
+        if (!node->perf->start(threads)) {
+            if (!warned)
+                std::cerr << "[Metrics] - Hardware counters are not available, " << node->perf->error() << std::endl;
+            warned = true;
+            node->perf.reset();
+        }
+    }
+    node->timer.reset();
+    open.push_back(node);
+}
+
+/**
+ * @brief Close the innermost open phase
+ *
+ */
+void Metrics::end() {
+    if (!on || open.size() <= 1) return;
+    Node* node = open.back();
+    node->nanoseconds += node->timer.nanoseconds();
+    node->peakMemory = peakMemory();
+    if (node->perf) {
+        for (const std::pair<std::string, uint64_t>& c : node->perf->stop())
+            count(c.first, c.second);
+        node->perf.reset();
+        std::vector<std::pair<std::string, double> > ratios = perPair(*node);
+        if (!ratios.empty()) {
+            std::cout << "[Metrics] - " << node->name << ":";
+            for (size_t r = 0; r < ratios.size(); ++r)
+                std::cout << (r > 0 ? "," : "") << " " << std::setprecision(4) << ratios[r].second << " " << ratios[r].first;
+            std::cout << " per pair evaluated";
+            if (instructionsPerCycle(*node) > 0)
+                std::cout << ", " << std::setprecision(3) << instructionsPerCycle(*node) << " instructions per cycle";
+            std::cout << "." << std::endl;
+        }
+    }
+    open.pop_back();
+}
+
+/**
+ * @brief Add to a counter of the innermost open phase
+ *
+ * @param counter
+ * @param n
+ */
+void Metrics::count(const std::string& counter, uint64_t n) {
+    if (!on) return;
+    std::vector<std::pair<std::string, uint64_t> >& counters = open.back()->counters;
+    for (std::pair<std::string, uint64_t>& c : counters) {
+        if (c.first == counter) {
+            c.second += n;
+            return;
+        }
+    }
+    counters.emplace_back(counter, n);
+}
+
+/**
+ * @brief Add the seconds each thread worked (not waiting for the others) to the innermost open phase
+ *
+ * @param seconds seconds of each thread
+ */
+void Metrics::busy(const std::vector<double>& seconds) {
+    if (!on) return;
+    std::vector<double>& total = open.back()->busy;
+    if (total.size() < seconds.size())
+        total.resize(seconds.size(), 0);
+    for (size_t t = 0; t < seconds.size(); ++t)
+        total[t] += seconds[t];
+}
+
+/**
+ * @brief Counters and busy time of a kernel over pairs
+ *
+ * @param evaluated pairs whose relation was computed
+ * @param pruned pairs skipped by a bound below the threshold
+ * @param skipped pairs without a value (NaN or a constant column)
+ * @param emitted pairs passing the threshold
+ * @param seconds seconds each thread worked
+ */
+void Metrics::countPairs(uint64_t evaluated, uint64_t pruned, uint64_t skipped, uint64_t emitted, const std::vector<double>& seconds) {
+    count("pairs_evaluated", evaluated);
+    count("pairs_pruned", pruned);
+    count("pairs_nan_skipped", skipped);
+    count("pairs_emitted", emitted);
+    busy(seconds);
+}
+
+/**
+ * @brief Peak resident memory of the process so far
+ *
+ * @return bytes, 0 where it is not available
+ */
+uint64_t Metrics::peakMemory() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    // kilobytes on Linux
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Write the metrics to the file given to enable()
+ *
+ * @return true
+ * @return false
+ */
+bool Metrics::write() const {
+    if (!on || filename.empty()) return true;
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "[Metrics] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    int64_t nanoseconds = root.timer.nanoseconds();
+    std::map<std::string, uint64_t> sums;
+    std::vector<std::string> names;
+    total(root, sums, names);
+    out << "{\n";
+    out << "  \"command\": " << quote(command) << ",\n";
+    out << "  \"nanoseconds\": " << nanoseconds << ",\n";
+    out << "  \"seconds\": " << std::setprecision(9) << nanoseconds * 1e-9 << ",\n";
+    out << "  \"peak_rss_bytes\": " << peakMemory() << ",\n";
+    out << "  \"counters\": {";
+    for (size_t c = 0; c < names.size(); ++c)
+        out << (c > 0 ? ", " : "") << quote(names[c]) << ": " << sums[names[c]];
+    out << "},\n";
+    out << "  \"phases\": [\n";
+    for (size_t c = 0; c < root.children.size(); ++c) {
+        writeNode(out, *root.children[c], 2);
+        out << (c + 1 < root.children.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+    if (!out.good()) {
+        std::cerr << "[Metrics] - Failed to write file: " << filename << std::endl;
+        return false;
+    }
+    std::cout << "[Metrics] - Wrote the metrics of the run to " << filename << std::endl;
+    return true;
+}
+
+/**
+ * @brief Open a phase of the global metrics
+ *
+ * @param name
+ * @param threads threads of the kernels of the phase, 0 for none
+ */
+Metrics::Phase::Phase(const std::string& name, size_t threads) : open(Metrics::global().enabled()) {
+    if (open)
+        Metrics::global().begin(name, threads);
+}
+
+Metrics::Phase::~Phase() {
+    if (open)
+        Metrics::global().end();
+}
@@ -0,0 +1,78 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+#include "timer.h"
+#include "perf.h"
+
+/**
+ * Phase timers and counters of a process, written as JSON with --metrics. A phase begun while
+ * another is open is timed as its child, a phase begun again under the same parent adds to its
+ * time. Counters and the busy time of the threads go to the innermost open phase, the file
+ * also has the totals of the counters and the peak resident memory of the process.
+ *
+ * Phases and counters are recorded by the thread that starts the parallel regions, between
+ * them. Nothing is recorded unless the metrics are enabled.
+ *
+ * With hardware counters enabled (--perf), a phase given the number of threads of its
+ * kernels also counts their cycles, instructions, cache and branch misses, reported per
+ * pair evaluated in the phase.
+ */
+class Metrics {
+public:
+    /** a phase open for the lifetime of the object */
+    class Phase {
+    public:
+        explicit Phase(const std::string& name, size_t threads=0);
+        ~Phase();
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+    private:
+        bool open;
+    };
+
+    static Metrics& global();
+
+    void enable(const std::string& filename, const std::string& command, bool hardware=false);
+    bool enabled() const { return on; }
+
+    void begin(const std::string& name, size_t threads=0);
+    void end();
+    void count(const std::string& counter, uint64_t n);
+    void busy(const std::vector<double>& seconds);
+    void countPairs(uint64_t evaluated, uint64_t pruned, uint64_t skipped, uint64_t emitted, const std::vector<double>& seconds);
+
+    bool write() const;
+
+    static uint64_t peakMemory();
+
+private:
+    struct Node {
+        std::string name;
+        uint64_t calls = 0;
+        int64_t nanoseconds = 0;
+        uint64_t peakMemory = 0;                              // peak of the process at the end of the phase
+        Timer timer;
+        std::vector<std::pair<std::string, uint64_t> > counters;
+        std::vector<double> busy;                             // seconds of work of each thread
+        std::vector<std::unique_ptr<Node> > children;
+        std::unique_ptr<PerfCounters> perf;                  // counting while the phase is open
+    };
+
+    bool on = false;
+    bool hardware = false;
+    bool warned = false;        // hardware counters are not available
+    std::string filename;
+    std::string command;
+    Node root;
+    std::vector<Node*> open;    // innermost phase last
+
+    Metrics();
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <omp.h>
+
+#include "utils.h"
+#include "numa.h"
+
+Numa::Numa() {}
+
+/**
+ * @brief Parse a cpulist of /sys, eg. 0-63,128-191
+ *
+ * @param list
+ * @return CPUs
+ */
+std::vector<int> Numa::parseList(const std::string& list) {
+    std::vector<int> ids;
+    std::vector<std::string> ranges, bounds;
+    Utils::split(Utils::strip(list), ranges, ",");
+    for (const auto& range : ranges) {
+        if (range.empty()) continue;
+        Utils::split(range, bounds, "-");
+        int first = std::stoi(bounds[0]);
+        int last = bounds.size() > 1 ? std::stoi(bounds[1]) : first;
+        for (int id = first; id <= last; ++id)
+            ids.push_back(id);
+    }
+    return ids;
+}
+
+/**
+ * @brief Read the topology and distribute the threads over the nodes
+ *
+ * @param nthreads
+ * @return true if more than one node is available
+ */
+bool Numa::setup(size_t nthreads) {
+    threads = std::max<size_t>(nthreads, 1);
+    cpus.clear();
+#ifdef __linux__
+    for (int n = 0; ; ++n) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+        if (!file.is_open()) break;
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> ids = parseList(list);
+        if (!ids.empty())
+            cpus.push_back(ids);
+    }
+#endif
+    if (cpus.empty()) {
+        cpus.push_back({});
+    }
+    // never more nodes than threads
+    if (cpus.size() > threads) {
+        cpus.resize(threads);
+    }
+    return cpus.size() > 1;
+}
+
+/**
+ * @brief Node of a thread, threads are assigned to nodes in contiguous blocks
+ *
+ * @param thread
+ * @return int
+ */
+int Numa::node(int thread) const {
+    return static_cast<int>(thread * cpus.size() / threads);
+}
+
+/**
+ * @brief Pin the calling OpenMP thread to one CPU of its node
+ *
+ */
+void Numa::pin() const {
+#ifdef __linux__
+    int thread = omp_get_thread_num();
+    int n = node(thread);
+    const auto& ids = cpus[n];
+    if (ids.empty()) return;
+    // index of the thread within its node
+    int first = (n * threads + cpus.size() - 1) / cpus.size();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(ids[(thread - first) % ids.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+/**
+ * @brief Copy a matrix once per node, each copy is written (first touched) by the threads
+ *        of its node so that its pages are allocated on that node. Must be called outside
+ *        of a parallel region, after the threads are pinned.
+ *
+ * @param data
+ * @return one matrix per node
+ */
+std::vector<MatrixXd> Numa::replicate(const Ref<const MatrixXd>& data) const {
+    std::vector<MatrixXd> replicas(cpus.size());
+    for (auto& replica : replicas)
+        replica.resize(data.rows(), data.cols());
+    #pragma omp parallel num_threads(threads)
+    {
+        int thread = omp_get_thread_num();
+        int n = node(thread);
+        // threads of node n copy an equal share of the columns
+        int first = (n * threads + cpus.size() - 1) / cpus.size();
+        int last = ((n + 1) * threads + cpus.size() - 1) / cpus.size();
+        Index share = (data.cols() + last - first - 1) / (last - first);
+        Index begin = std::min<Index>((thread - first) * share, data.cols());
+        Index end = std::min<Index>(begin + share, data.cols());
+        if (end > begin)
+            replicas[n].middleCols(begin, end - begin) = data.middleCols(begin, end - begin);
+    }
+    return replicas;
+}
+
+/**
+ * @brief Pin the threads to the nodes and replicate the source and target data of an engine
+ *        on every node
+ *
+ * @param nthreads threads of the kernels
+ * @param source
+ * @param target empty without target data
+ * @param tag log prefix of the engine
+ * @return true if the data is replicated, false on a single node
+ */
+bool Numa::place(size_t nthreads, const Ref<const MatrixXd>& source, const Ref<const MatrixXd>& target, const std::string& tag) {
+    sourceCopies.clear();
+    targetCopies.clear();
+    if (!setup(nthreads)) {
+        std::cout << "[" << tag << "] - Only one NUMA node is available, the data is not replicated." << std::endl;
+        return false;
+    }
+    omp_set_num_threads(threads);
+    #pragma omp parallel
+    pin();
+    sourceCopies = replicate(source);
+    if (target.size() > 0)
+        targetCopies = replicate(target);
+    std::cout << "[" << tag << "] - The data is replicated on " << nodes() << " NUMA nodes." << std::endl;
+    return true;
+}
+
+/**
+ * @brief Matrix read by the calling thread, the copy of its node if replicated
+ *
+ * @param data
+ * @param replicas copies of data on each node, empty for none
+ * @return Map<const MatrixXd>
+ */
+Map<const MatrixXd> Numa::local(const Ref<const MatrixXd>& data, const std::vector<MatrixXd>& replicas) const {
+    if (replicas.empty()) return Map<const MatrixXd>(data.data(), data.rows(), data.cols());
+    const MatrixXd& replica = replicas[node(omp_get_thread_num())];
+    return Map<const MatrixXd>(replica.data(), replica.rows(), replica.cols());
+}
@@ -0,0 +1,45 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+#include <string>
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+/**
+ * NUMA placement of the worker threads. Threads are split into contiguous blocks, one
+ * block per node, and pinned to the CPUs of their node. Matrices can be replicated so
+ * that every node reads its own copy, pages are first touched by the threads of the node.
+ * The topology is read from /sys on Linux, other systems behave as a single node.
+ *
+ * place() pins the threads of an engine and replicates its source and target data, the
+ * kernels then read the copy of the node of their thread through the views.
+ */
+class Numa {
+public:
+    Numa();
+
+    bool setup(size_t threads);
+    size_t nodes() const { return cpus.size(); }
+    int node(int thread) const;
+    void pin() const;
+    std::vector<MatrixXd> replicate(const Ref<const MatrixXd>& data) const;
+
+    bool place(size_t threads, const Ref<const MatrixXd>& source, const Ref<const MatrixXd>& target, const std::string& tag);
+    bool placed() const { return !sourceCopies.empty(); }
+    Map<const MatrixXd> local(const Ref<const MatrixXd>& data, const std::vector<MatrixXd>& replicas) const;
+    Map<const MatrixXd> sourceView(const Ref<const MatrixXd>& source) const { return local(source, sourceCopies); }
+    Map<const MatrixXd> targetView(const Ref<const MatrixXd>& target) const { return local(target, targetCopies); }
+
+private:
+    size_t threads = 1;
+    std::vector<std::vector<int> > cpus;  // CPUs of each node
+    std::vector<MatrixXd> sourceCopies;   // copies of the data of an engine on each node, empty unless placed
+    std::vector<MatrixXd> targetCopies;
+
+    static std::vector<int> parseList(const std::string& list);
+};
+
+#endif
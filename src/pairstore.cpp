@@ -0,0 +1,446 @@
+#include <cmath>
+#include <limits>
+#include <charconv>
+#include <numeric>
+#include <fstream>
+#include <algorithm>
+
+#include <omp.h>
+
+#include "utils.h"
+#include "pairstore.h"
+
+namespace {
+    using Utils::writeValue;
+    using Utils::readValue;
+    using Utils::writeString;
+    using Utils::readString;
+
+    const char MAGIC[4] = {'G', 'P', 'S', 'T'};
+    const uint32_t VERSION = 1;
+    const uint32_t MAX_COLUMNS = 64;      // keys or values of a record, more is a damaged file
+    const size_t FORMAT_CHUNK = 1 << 16;  // records formatted by a thread at a time
+}
+
+PairStore::PairStore() {}
+
+PairStore::PairStore(size_t nkeys, size_t nvals) {
+    reset(nkeys, nvals);
+}
+
+/**
+ * @brief Remove all records and define the record layout
+ *
+ * @param nkeys number of feature indices of a record
+ * @param nvals number of values of a record
+ */
+void PairStore::reset(size_t nkeys, size_t nvals) {
+    nk = nkeys;
+    nv = nvals;
+    keyDict.assign(nk, 0);
+    keyNames.assign(nk, "");
+    valNames.assign(nv, "");
+    scales.assign(nv, 1.0);
+    clear();
+}
+
+/**
+ * @brief An empty store with the same layout, without the name dictionaries
+ *
+ * @return PairStore
+ */
+PairStore PairStore::layout() const {
+    PairStore store(nk, nv);
+    store.keyDict = keyDict;
+    store.keyNames = keyNames;
+    store.valNames = valNames;
+    store.scales = scales;
+    return store;
+}
+
+void PairStore::clear() {
+    nrecords = 0;
+    sorted = false;
+    keys.clear();
+    vals.clear();
+    offsets.clear();
+}
+
+void PairStore::reserve(size_t n) {
+    keys.reserve(n * nk);
+    vals.reserve(n * nv);
+}
+
+void PairStore::push(const uint32_t* k, const int16_t* v) {
+    keys.insert(keys.end(), k, k + nk);
+    vals.insert(vals.end(), v, v + nv);
+    nrecords++;
+    sorted = false;
+}
+
+void PairStore::push(std::initializer_list<uint32_t> k, std::initializer_list<int16_t> v) {
+    push(k.begin(), v.begin());
+}
+
+/**
+ * @brief Append the records of another store with the same layout
+ *
+ * @param other
+ */
+void PairStore::append(const PairStore& other) {
+    keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+    vals.insert(vals.end(), other.vals.begin(), other.vals.end());
+    nrecords += other.nrecords;
+    sorted = false;
+}
+
+/**
+ * @brief Append the records [begin, end) of another store with the same layout
+ *
+ * @param other
+ * @param begin
+ * @param end
+ */
+void PairStore::append(const PairStore& other, size_t begin, size_t end) {
+    keys.insert(keys.end(), other.keys.begin() + begin * nk, other.keys.begin() + end * nk);
+    vals.insert(vals.end(), other.vals.begin() + begin * nv, other.vals.begin() + end * nv);
+    nrecords += end - begin;
+    sorted = false;
+}
+
+/**
+ * @brief Round a scaled value to the 16-bit storage type
+ *
+ * @param value
+ * @return int16_t
+ */
+int16_t PairStore::quantize(double value) {
+    if (std::isnan(value)) return 0;
+    value = std::round(value);
+    value = std::min<double>(value, std::numeric_limits<int16_t>::max());
+    value = std::max<double>(value, std::numeric_limits<int16_t>::min());
+    return static_cast<int16_t>(value);
+}
+
+/**
+ * @brief Scale of a count value out of `total`, counts are stored exactly
+ *        as long as total fits the 16-bit storage type
+ *
+ * @param total
+ * @return double
+ */
+double PairStore::countScale(size_t total) {
+    return std::min<double>(total, std::numeric_limits<int16_t>::max());
+}
+
+/**
+ * @brief Sort records by keys and index them by the first key
+ *
+ */
+void PairStore::sort() {
+    std::vector<size_t> order(nrecords);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return std::lexicographical_compare(keys.begin() + a * nk, keys.begin() + (a + 1) * nk,
+                                            keys.begin() + b * nk, keys.begin() + (b + 1) * nk);
+    });
+    std::vector<uint32_t> sortedKeys(keys.size());
+    std::vector<int16_t> sortedVals(vals.size());
+    for (size_t r = 0; r < nrecords; ++r) {
+        std::copy_n(keys.begin() + order[r] * nk, nk, sortedKeys.begin() + r * nk);
+        std::copy_n(vals.begin() + order[r] * nv, nv, sortedVals.begin() + r * nv);
+    }
+    keys.swap(sortedKeys);
+    vals.swap(sortedVals);
+
+    size_t nfirst = dicts.empty() ? 0 : dicts[keyDict[0]].size();
+    offsets.assign(nfirst + 1, 0);
+    for (size_t r = 0; r < nrecords; ++r)
+        offsets[key(r, 0) + 1]++;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    sorted = true;
+}
+
+/**
+ * @brief Records whose first key is `first`, only available for sorted stores
+ *
+ * @param first
+ * @return [begin, end) of records
+ */
+std::pair<size_t, size_t> PairStore::range(uint32_t first) const {
+    if (!sorted || first + 1 >= offsets.size()) return {0, 0};
+    return {offsets[first], offsets[first + 1]};
+}
+
+/**
+ * @brief Index of a feature name in the dictionary of the first key
+ *
+ * @param name
+ * @return index, -1 if not found
+ */
+int PairStore::lookup(const std::string& name) const {
+    if (dicts.empty()) return -1;
+    const auto& dict = dicts[keyDict[0]];
+    auto it = std::find(dict.begin(), dict.end(), name);
+    return it == dict.end() ? -1 : static_cast<int>(it - dict.begin());
+}
+
+/**
+ * @brief Save records to the binary format
+ *
+ * @param filename
+ * @return true
+ * @return false
+ */
+bool PairStore::save(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[Pair Store] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    return save(file);
+}
+
+/**
+ * @brief Write records in the binary format to a stream, eg. embedded in another file
+ *
+ * @param os
+ * @return true
+ * @return false
+ */
+bool PairStore::save(std::ostream& os) const {
+    os.write(MAGIC, sizeof(MAGIC));
+    writeValue<uint32_t>(os, VERSION);
+    writeValue<uint32_t>(os, nk);
+    writeValue<uint32_t>(os, nv);
+    writeValue<uint64_t>(os, nrecords);
+    writeValue<uint32_t>(os, sorted ? 1 : 0);
+    writeValue<uint32_t>(os, dicts.size());
+    for (const auto& dict : dicts) {
+        writeValue<uint32_t>(os, dict.size());
+        for (const auto& name : dict)
+            writeString(os, name);
+    }
+    for (size_t c = 0; c < nk; ++c) {
+        writeValue<uint32_t>(os, keyDict[c]);
+        writeString(os, keyNames[c]);
+    }
+    for (size_t c = 0; c < nv; ++c) {
+        writeValue<double>(os, scales[c]);
+        writeString(os, valNames[c]);
+    }
+    os.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(uint32_t));
+    os.write(reinterpret_cast<const char*>(vals.data()), vals.size() * sizeof(int16_t));
+    if (sorted)
+        os.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    return static_cast<bool>(os);
+}
+
+/**
+ * @brief Read the header of the binary format, the sizes are checked against the bytes left
+ *        in the stream so that a damaged file is rejected instead of allocated
+ *
+ * @param is
+ * @return true
+ * @return false
+ */
+bool PairStore::readHeader(std::istream& is) {
+    char magic[4];
+    uint32_t version, nkeys, nvals, flag, ndicts;
+    uint64_t records;
+    if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, MAGIC)) return false;
+    if (!readValue(is, version) || version != VERSION) return false;
+    if (!readValue(is, nkeys) || !readValue(is, nvals) || !readValue(is, records) ||
+        !readValue(is, flag) || !readValue(is, ndicts)) return false;
+    // every dictionary and name takes at least its 4 byte size
+    uint64_t left = Utils::remaining(is);
+    if (nkeys == 0 || nkeys > MAX_COLUMNS || nvals > MAX_COLUMNS || ndicts > left / 4) return false;
+    reset(nkeys, nvals);
+    dicts.resize(ndicts);
+    for (auto& dict : dicts) {
+        uint32_t size;
+        if (!readValue(is, size) || size > left / 4) return false;
+        dict.resize(size);
+        for (auto& name : dict)
+            if (!readString(is, name)) return false;
+    }
+    for (size_t c = 0; c < nk; ++c)
+        if (!readValue(is, keyDict[c]) || keyDict[c] >= dicts.size() || !readString(is, keyNames[c])) return false;
+    for (size_t c = 0; c < nv; ++c)
+        if (!readValue(is, scales[c]) || !readString(is, valNames[c])) return false;
+    nrecords = records;
+    sorted = flag == 1;
+    // records and the index of a sorted file
+    left = Utils::remaining(is);
+    uint64_t recordBytes = nk * sizeof(uint32_t) + nv * sizeof(int16_t);
+    if (nrecords > left / recordBytes) return false;
+    if (sorted && (dicts[keyDict[0]].size() + 1) * sizeof(uint64_t) > left - nrecords * recordBytes) return false;
+    return true;
+}
+
+/**
+ * @brief Whether the records read from a file index their dictionaries and the index of a
+ *        sorted file is in order
+ *
+ * @return true
+ * @return false
+ */
+bool PairStore::validRecords() const {
+    for (size_t c = 0; c < nk; ++c) {
+        size_t size = dicts[keyDict[c]].size();
+        for (size_t r = 0; r < nrecords; ++r)
+            if (keys[r * nk + c] >= size) return false;
+    }
+    if (!sorted) return true;
+    if (offsets.front() != 0 || offsets.back() != nrecords) return false;
+    for (size_t f = 1; f < offsets.size(); ++f)
+        if (offsets[f] < offsets[f - 1]) return false;
+    return true;
+}
+
+/**
+ * @brief Load all records from the binary format
+ *
+ * @param filename
+ * @return true
+ * @return false
+ */
+bool PairStore::load(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open() || !load(file)) {
+        std::cerr << "[Pair Store] - Invalid pair file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read records in the binary format from a stream
+ *
+ * @param is
+ * @return true
+ * @return false
+ */
+bool PairStore::load(std::istream& is) {
+    if (!readHeader(is)) return false;
+    keys.resize(nrecords * nk);
+    vals.resize(nrecords * nv);
+    is.read(reinterpret_cast<char*>(keys.data()), keys.size() * sizeof(uint32_t));
+    is.read(reinterpret_cast<char*>(vals.data()), vals.size() * sizeof(int16_t));
+    if (sorted) {
+        offsets.resize(dicts[keyDict[0]].size() + 1);
+        is.read(reinterpret_cast<char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    }
+    return static_cast<bool>(is) && validRecords();
+}
+
+/**
+ * @brief Load only the records whose first key is `feature`, seeking through the index
+ *        of a sorted file instead of scanning all records
+ *
+ * @param filename
+ * @param feature
+ * @return true
+ * @return false
+ */
+bool PairStore::load(const std::string& filename, const std::string& feature) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open() || !readHeader(file)) {
+        std::cerr << "[Pair Store] - Invalid pair file: " << filename << std::endl;
+        return false;
+    }
+    if (!sorted) {
+        std::cerr << "[Pair Store] - The pair file is not sorted, query by feature needs a sorted file." << std::endl;
+        return false;
+    }
+    int first = lookup(feature);
+    size_t total = nrecords;
+    nrecords = 0;
+    sorted = false;
+    if (first < 0) return true;
+    std::streamoff keyStart = file.tellg();
+    std::streamoff valStart = keyStart + total * nk * sizeof(uint32_t);
+    std::streamoff idxStart = valStart + total * nv * sizeof(int16_t);
+    uint64_t bounds[2];
+    file.seekg(idxStart + first * sizeof(uint64_t));
+    if (!file.read(reinterpret_cast<char*>(bounds), sizeof(bounds)) || bounds[0] > bounds[1] || bounds[1] > total) return false;
+    nrecords = bounds[1] - bounds[0];
+    keys.resize(nrecords * nk);
+    vals.resize(nrecords * nv);
+    file.seekg(keyStart + bounds[0] * nk * sizeof(uint32_t));
+    file.read(reinterpret_cast<char*>(keys.data()), keys.size() * sizeof(uint32_t));
+    file.seekg(valStart + bounds[0] * nv * sizeof(int16_t));
+    file.read(reinterpret_cast<char*>(vals.data()), vals.size() * sizeof(int16_t));
+    return static_cast<bool>(file) && validRecords();
+}
+
+/**
+ * @brief Digits after the decimal point of a value column, exact for power of ten scales
+ *
+ * @param c value column
+ * @return int
+ */
+int PairStore::precision(size_t c) const {
+    double digits = std::log10(scales[c]);
+    if (digits >= 0 && digits <= 6 && digits == std::round(digits)) {
+        return static_cast<int>(digits);
+    }
+    return 6;
+}
+
+/**
+ * @brief Format records [begin, end) as delimited text
+ *
+ * @param begin
+ * @param end
+ * @param delim
+ * @param out
+ */
+void PairStore::format(size_t begin, size_t end, char delim, std::string& out) const {
+    std::vector<int> digits(nv);
+    for (size_t c = 0; c < nv; ++c)
+        digits[c] = precision(c);
+    out.clear();
+    char number[64];
+    for (size_t r = begin; r < end; ++r) {
+        for (size_t c = 0; c < nk; ++c) {
+            out.append(name(r, c));
+            out.push_back(delim);
+        }
+        for (size_t c = 0; c < nv; ++c) {
+            auto res = std::to_chars(number, number + sizeof(number), real(r, c), std::chars_format::fixed, digits[c]);
+            out.append(number, res.ptr);
+            out.push_back(c + 1 == nv ? '\n' : delim);
+        }
+    }
+}
+
+/**
+ * @brief Write records as delimited text, chunks of records are formatted in parallel
+ *        and written in order
+ *
+ * @param os
+ * @param delim
+ * @param header
+ * @param threads
+ */
+void PairStore::write(std::ostream& os, char delim, bool header, size_t threads) const {
+    if (header) {
+        for (size_t c = 0; c < nk; ++c)
+            os << keyNames[c] << delim;
+        for (size_t c = 0; c < nv; ++c)
+            os << valNames[c] << (c + 1 == nv ? '\n' : delim);
+    }
+    threads = std::max<size_t>(threads, 1);
+    std::vector<std::string> buffers(threads);
+    for (size_t start = 0; start < nrecords; start += threads * FORMAT_CHUNK) {
+        size_t nchunks = std::min(threads, (nrecords - start + FORMAT_CHUNK - 1) / FORMAT_CHUNK);
+        #pragma omp parallel for num_threads(threads) schedule(static, 1)
+        for (size_t t = 0; t < nchunks; ++t) {
+            size_t begin = start + t * FORMAT_CHUNK;
+            format(begin, std::min(begin + FORMAT_CHUNK, nrecords), delim, buffers[t]);
+        }
+        for (size_t t = 0; t < nchunks; ++t)
+            os.write(buffers[t].data(), buffers[t].size());
+    }
+}
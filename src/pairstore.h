@@ -0,0 +1,88 @@
+#ifndef PAIRSTORE_H
+#define PAIRSTORE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <functional>
+#include <initializer_list>
+
+/**
+ * Compact result container. Every record is a fixed number of packed 32-bit feature
+ * indices (keys) followed by a fixed number of 16-bit quantized values, the real value
+ * of a value column is stored / scale. Feature names are kept once in dictionaries.
+ *
+ * Binary file layout (native byte order):
+ *   magic "GPST", u32 version, u32 nkeys, u32 nvals, u64 records, u32 sorted
+ *   u32 ndicts, each dict: u32 size, names as (u32 length, bytes)
+ *   each key column: u32 dict id, label
+ *   each value column: f64 scale, label
+ *   keys (records * nkeys u32), values (records * nvals i16)
+ *   if sorted: offsets of the first key (dict size + 1 u64)
+ */
+class PairStore {
+public:
+    std::vector<std::vector<std::string> > dicts;  // name dictionaries
+    std::vector<uint32_t> keyDict;                 // dictionary of each key column
+    std::vector<std::string> keyNames;             // header of key columns
+    std::vector<std::string> valNames;             // header of value columns
+    std::vector<double> scales;                    // real value = stored value / scale
+
+    PairStore();
+    PairStore(size_t nkeys, size_t nvals);
+
+    void reset(size_t nkeys, size_t nvals);
+    PairStore layout() const;
+    void clear();
+    void reserve(size_t n);
+    size_t size() const { return nrecords; }
+    size_t nkeys() const { return nk; }
+    size_t nvals() const { return nv; }
+    bool isSorted() const { return sorted; }
+
+    void push(const uint32_t* keys, const int16_t* vals);
+    void push(std::initializer_list<uint32_t> keys, std::initializer_list<int16_t> vals);
+    void append(const PairStore& other);
+    void append(const PairStore& other, size_t begin, size_t end);
+
+    uint32_t key(size_t r, size_t c) const { return keys[r * nk + c]; }
+    int16_t value(size_t r, size_t c) const { return vals[r * nv + c]; }
+    double real(size_t r, size_t c) const { return vals[r * nv + c] / scales[c]; }
+    int16_t encode(size_t c, double real) const { return quantize(real * scales[c]); }
+    const std::string& name(size_t r, size_t c) const { return dicts[keyDict[c]][key(r, c)]; }
+
+    void sort();
+    std::pair<size_t, size_t> range(uint32_t first) const;
+    int lookup(const std::string& name) const;
+
+    bool save(const std::string& filename) const;
+    bool save(std::ostream& os) const;
+    bool load(const std::string& filename);
+    bool load(std::istream& is);
+    bool load(const std::string& filename, const std::string& feature);
+    void write(std::ostream& os, char delim, bool header=true, size_t threads=1) const;
+
+    static int16_t quantize(double value);
+    static double countScale(size_t total);
+
+private:
+    size_t nk = 2;
+    size_t nv = 1;
+    size_t nrecords = 0;
+    bool sorted = false;
+    std::vector<uint32_t> keys;
+    std::vector<int16_t> vals;
+    std::vector<uint64_t> offsets;  // records of the first key, only when sorted
+
+    bool readHeader(std::istream& is);
+    bool validRecords() const;
+    int precision(size_t c) const;
+    void format(size_t begin, size_t end, char delim, std::string& out) const;
+};
+
+// receives batches of pairs, batches have the layout of the results without the name dictionaries;
+// it runs inside the OpenMP region, so it must not throw (an exception terminates the process)
+typedef std::function<void(const PairStore&)> PairSink;
+
+#endif
@@ -0,0 +1,131 @@
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include <cerrno>
+#include <cstring>
+#include <omp.h>
+
+#include "perf.h"
+
+const char* const PerfCounters::NAMES[PerfCounters::NEVENTS] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+
+namespace {
+#ifdef __linux__
+    /**
+     * @brief Open a counter of the calling thread on any CPU, counting from now on
+     *
+     * @param event index in PerfCounters::NAMES
+     * @return file descriptor, -1 on failure (errno is set)
+     */
+    int openCounter(int event) {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (event) {
+            case 0:
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case 1:
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case 2:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            default:
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        }
+        // user space only, allowed with the default perf_event_paranoid of most systems
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // more counters than the PMU has are multiplexed, the counts are scaled by the time counted
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+}
+
+PerfCounters::PerfCounters() {}
+
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+/**
+ * @brief Open the counters of each thread of an OpenMP team of this size
+ *
+ * @param threads
+ * @return true if at least one counter is counting
+ * @return false
+ */
+bool PerfCounters::start(size_t threads) {
+    close();
+    reason.clear();
+    fds.assign(threads * NEVENTS, -1);
+#ifdef __linux__
+    int failure = 0;
+    omp_set_num_threads(threads);
+    #pragma omp parallel
+    {
+        size_t t = omp_get_thread_num();
+        for (int e = 0; e < NEVENTS && t < threads; ++e) {
+            int fd = openCounter(e);
+            if (fd < 0) {
+                int code = errno;
+                #pragma omp atomic write
+                failure = code;
+            }
+            fds[t * NEVENTS + e] = fd;
+        }
+    }
+    for (int fd : fds)
+        if (fd >= 0) return true;
+    reason = std::string("perf_event_open failed: ") + std::strerror(failure);
+    if (failure == EACCES || failure == EPERM)
+        reason += ", see /proc/sys/kernel/perf_event_paranoid";
+    return false;
+#else
+    reason = "hardware counters are only read on Linux";
+    return false;
+#endif
+}
+
+/**
+ * @brief Read and close the counters
+ *
+ * @return the sum over the threads of each counter that was counting, in the order of NAMES
+ */
+std::vector<std::pair<std::string, uint64_t> > PerfCounters::stop() {
+    std::vector<std::pair<std::string, uint64_t> > counts;
+#ifdef __linux__
+    size_t threads = fds.size() / NEVENTS;
+    for (int e = 0; e < NEVENTS; ++e) {
+        double total = 0;
+        bool counted = false;
+        for (size_t t = 0; t < threads; ++t) {
+            int fd = fds[t * NEVENTS + e];
+            // value, time enabled, time running
+            uint64_t values[3];
+            if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) continue;
+            total += values[2] < values[1] ? values[0] * (1.0 * values[1] / values[2]) : values[0];
+            counted = true;
+        }
+        if (counted)
+            counts.emplace_back(NAMES[e], static_cast<uint64_t>(total + 0.5));
+    }
+#endif
+    close();
+    return counts;
+}
+
+void PerfCounters::close() {
+#ifdef __linux__
+    for (int fd : fds)
+        if (fd >= 0) ::close(fd);
+#endif
+    fds.clear();
+}
@@ -0,0 +1,38 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+/**
+ * Hardware counters of the threads of a parallel phase (--perf): cycles, instructions,
+ * last level cache misses and branch misses, read with perf_event_open on Linux. Every
+ * OpenMP thread of the team opens its own counters, user space only, so they count the
+ * kernels run by the same threads afterwards (the OpenMP runtime keeps its threads between
+ * parallel regions). Counters the kernel or the machine does not provide are left out,
+ * other systems have none.
+ */
+class PerfCounters {
+public:
+    static const int NEVENTS = 4;
+    static const char* const NAMES[NEVENTS];
+
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool start(size_t threads);
+    std::vector<std::pair<std::string, uint64_t> > stop();
+    const std::string& error() const { return reason; }
+
+private:
+    std::vector<int> fds;       // threads * NEVENTS, -1 for a counter that could not be opened
+    std::string reason;         // why no counter could be opened
+
+    void close();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#include "plan.h"
+
+namespace {
+    std::string bytes(double n) {
+        const char* units[] = {"B", "KB", "MB", "GB", "TB", "PB"};
+        int u = 0;
+        while (n >= 1024 && u < 5) {
+            n /= 1024;
+            u++;
+        }
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(u == 0 ? 0 : 1) << n << " " << units[u];
+        return os.str();
+    }
+
+    std::string duration(double seconds) {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(1);
+        if (seconds < 120)
+            os << seconds << " s";
+        else if (seconds < 7200)
+            os << seconds / 60 << " min";
+        else if (seconds < 172800)
+            os << seconds / 3600 << " h";
+        else
+            os << seconds / 86400 << " days";
+        return os.str();
+    }
+}
+
+/**
+ * @brief Pairs of the selected features with all columns, a pair of two selected
+ *        features is evaluated once
+ *
+ * @param nselected
+ * @param ncols
+ * @return pairs
+ */
+uint64_t Plan::pairUnits(uint64_t nselected, uint64_t ncols) {
+    if (nselected == 0 || ncols == 0) return 0;
+    return nselected * (ncols - 1) - nselected * (nselected - 1) / 2;
+}
+
+/**
+ * @brief Mean length of the names of a dictionary
+ *
+ * @param names
+ * @return length
+ */
+double Plan::meanLength(const std::vector<std::string>& names) {
+    if (names.empty()) return 0;
+    double total = 0;
+    for (const std::string& name : names)
+        total += name.size();
+    return total / names.size();
+}
+
+/**
+ * @brief Print the estimates
+ *
+ * @param tag
+ */
+void Plan::report(const std::string& tag) const {
+    double rate = sampled > 0 ? 1.0 * hits / sampled : 0;
+    double results = rate * units;
+    double perUnit = sampled > 0 ? seconds / sampled : 0;
+    double outputBytes = results * (binary ? recordBytes : lineBytes);
+    double resultBytes = stored ? results * recordBytes : 0;
+    std::cout << "[" << tag << "] - Plan: " << units << " pairs to evaluate." << std::endl;
+    std::cout << "[" << tag << "] - Plan: " << hits << " of " << sampled << " sampled pairs pass the thresholds, hit rate "
+              << std::setprecision(3) << rate * 100 << "%." << std::endl;
+    if (hits == 0 && sampled > 0) {
+        // no hit in the sample, about 3 / sampled is the 95% upper bound of the rate
+        std::cout << "[" << tag << "] - Plan: the hit rate is below " << std::setprecision(3) << 300.0 / sampled
+                  << "% (95% bound)." << std::endl;
+    }
+    std::cout << "[" << tag << "] - Plan: about " << static_cast<uint64_t>(std::round(results)) << " results, "
+              << bytes(outputBytes) << " of " << (binary ? "binary" : "text") << " output." << std::endl;
+    std::cout << "[" << tag << "] - Plan: peak memory about " << bytes(dataBytes + resultBytes) << " (data "
+              << bytes(dataBytes) << ", results " << bytes(resultBytes) << ")." << std::endl;
+    std::cout << "[" << tag << "] - Plan: about " << duration(perUnit * units / std::max<size_t>(threads, 1)) << " on "
+              << threads << " threads (" << std::setprecision(3) << perUnit * 1e6 << " us per pair on one thread of this machine)." << std::endl;
+}
@@ -0,0 +1,34 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Estimates of a run that is not computed (--plan). The engines count the pairs (or triples)
+ * the run would evaluate, evaluate a random sample of them on one thread and fill in the
+ * sizes of their data and results; the hit rate, the output size, the peak memory and the
+ * runtime are extrapolated from the sample.
+ */
+struct Plan {
+    uint64_t units = 0;          // pairs (triples) evaluated by the run
+    uint64_t sampled = 0;        // units of the sample
+    uint64_t hits = 0;           // sampled units passing the thresholds
+    double seconds = 0;          // time of the sample on one thread
+    size_t threads = 1;
+    double dataBytes = 0;        // data and preprocessed copies kept during the run
+    double recordBytes = 0;      // result record in memory
+    double lineBytes = 0;        // result line of the text output
+    bool binary = false;         // .gpb output
+    bool stored = true;          // results are kept in memory until they are written
+
+    static const size_t SAMPLE = 20000;   // units evaluated for the estimates
+
+    static uint64_t pairUnits(uint64_t nselected, uint64_t ncols);
+    static double meanLength(const std::vector<std::string>& names);
+
+    void report(const std::string& tag) const;
+};
+
+#endif
@@ -0,0 +1,463 @@
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+namespace {
+    const int BLOCK = 64;   // source columns per block of the pairs query
+
+    int indexOf(const std::vector<std::string>& names, const std::string& name) {
+        auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? -1 : static_cast<int>(it - names.begin());
+    }
+
+    bool sendAll(int client, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read a whole field as a number
+     *
+     * @param field
+     * @param value
+     * @return true
+     * @return false
+     */
+    bool parseNumber(const std::string& field, double& value) {
+        if (field.empty()) return false;
+        char* end = nullptr;
+        value = std::strtod(field.c_str(), &end);
+        return *end == '\0' && std::isfinite(value);
+    }
+
+    /**
+     * @brief Whether a server is listening on a Unix socket
+     *
+     * @param addr
+     * @return true
+     * @return false
+     */
+    bool listening(const sockaddr_un& addr) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) return false;
+        bool success = connect(probe, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+        close(probe);
+        return success;
+    }
+}
+
+/**
+ * @brief Load the data once and precompute the standardized columns
+ *
+ * @param opts
+ */
+Server::Server(const ServeOptions& opts) : options(opts) {
+    func = Algorithm::getCorrelation(options.method);
+    Utils::getOperation(options.operation);
+    Timer timer = Timer();
+    // the queries read dense columns
+    source = new DataFrame(options.expression);
+    source->densify();
+    if (!options.target.empty() and Utils::exists(options.target)) {
+        target = new DataFrame(options.target);
+        target->densify();
+        if (target->data.rows() != source->data.rows()) {
+            throw std::invalid_argument("The number of data lines in the two files is inconsistent.");
+        }
+    }
+    omp_set_num_threads(options.threads);
+    bool ranks = options.method == "spearman";
+    if (options.method != "kendall") {
+        sprep.compute(source->data, ranks, options.threads);
+        if (target != nullptr)
+            tprep.compute(target->data, ranks, options.threads);
+    }
+    std::cout << "[Serve] - Loaded " << source->data.cols() << " source features";
+    if (target != nullptr)
+        std::cout << " and " << target->data.cols() << " target features";
+    std::cout << " of " << source->data.rows() << " samples in " << timer << std::endl;
+}
+
+Server::~Server() {
+    if (fd >= 0) {
+        close(fd);
+        if (bound)
+            unlink(options.socket.c_str());
+    }
+    if (source != nullptr) {
+        delete source;
+        source = nullptr;
+    }
+    if (target != nullptr) {
+        delete target;
+        target = nullptr;
+    }
+}
+
+/**
+ * @brief Correlations of a feature with all source features
+ *
+ * @param feature source or target feature
+ * @param cutoff
+ * @param result
+ * @param error
+ * @return true
+ * @return false
+ */
+bool Server::queryCorr(const std::string& feature, double cutoff, PairStore& result, std::string& error) {
+    const MatrixXd& S = source->data;
+    int self = indexOf(source->columns, feature);
+    int k = self;
+    const ColumnStats* prep = &sprep;
+    result.reset(2, 1);
+    if (self >= 0) {
+        result.dicts = {source->columns};
+        result.keyDict = {0, 0};
+    } else if (target != nullptr && (k = indexOf(target->columns, feature)) >= 0) {
+        prep = &tprep;
+        result.dicts = {target->columns, source->columns};
+        result.keyDict = {0, 1};
+    } else {
+        error = "Unknown feature: " + feature;
+        return false;
+    }
+    result.keyNames = {"feature", "source"};
+    result.valNames = {"corr"};
+    result.scales = {1000};
+    const MatrixXd& data = prep == &sprep ? S : target->data;
+    // one matrix-vector product when the feature has no NaN
+    bool fast = options.method != "kendall" && !prep->missing[k];
+    VectorXd dots;
+    if (fast)
+        dots = sprep.z.transpose() * prep->z.col(k);
+    int threshold = static_cast<int>(cutoff * 1000);
+    #pragma omp parallel
+    {
+        PairStore local = result.layout();
+        #pragma omp for schedule(static)
+        for (int j = 0; j < S.cols(); ++j) {
+            if (j == self) continue;
+            double r;
+            if (fast && !sprep.missing[j]) {
+                if (prep->norm[k] == 0 || sprep.norm[j] == 0) continue;
+                r = dots[j];
+            } else {
+                r = func(data.col(k), S.col(j));
+            }
+            if (std::isnan(r)) continue;
+            int corr = static_cast<int>(std::round(r * 1000));
+            if (abs(corr) > threshold)
+                local.push({(uint32_t)k, (uint32_t)j}, {(int16_t)corr});
+        }
+        #pragma omp critical(result)
+        result.append(local);
+    }
+    return true;
+}
+
+/**
+ * @brief Source pairs whose operation is correlated with a target feature. With pearson and
+ *        add/subtract the correlation follows from the standardized columns:
+ *        corr(a +- b, t) = (|a| r(a,t) +- |b| r(b,t)) / sqrt(|a|^2 + |b|^2 +- 2 |a| |b| r(a,b)),
+ *        |x| the norm of the centered column, r(a,b) computed by blocks of matrix products.
+ *
+ * @param feature target feature
+ * @param cutoff
+ * @param result
+ * @param error
+ * @return true
+ * @return false
+ */
+bool Server::queryPairs(const std::string& feature, double cutoff, PairStore& result, std::string& error) {
+    if (target == nullptr) {
+        error = "No target data loaded.";
+        return false;
+    }
+    int k = indexOf(target->columns, feature);
+    if (k < 0) {
+        error = "Unknown target feature: " + feature;
+        return false;
+    }
+    const MatrixXd& S = source->data;
+    const MatrixXd& T = target->data;
+    result.reset(3, 1);
+    result.dicts = {target->columns, source->columns};
+    result.keyDict = {0, 1, 1};
+    result.keyNames = {"feature", "source", "target"};
+    result.valNames = {std::string("corr(source") + Utils::getOperation(options.operation) + "target)"};
+    result.scales = {1000};
+    int ncols = S.cols();
+    int threshold = static_cast<int>(cutoff * 1000);
+    bool fast = options.method == "pearson" && !tprep.missing[k] &&
+                (options.operation == "add" || options.operation == "subtract");
+    if (fast && tprep.norm[k] == 0) return true;
+    double sign = options.operation == "add" ? 1 : -1;
+    VectorXd dots;
+    if (fast)
+        dots = sprep.z.transpose() * tprep.z.col(k);
+    int nblocks = (ncols + BLOCK - 1) / BLOCK;
+    #pragma omp parallel
+    {
+        PairStore local = result.layout();
+        MatrixXd gram;
+        VectorXd res;
+        #pragma omp for schedule(dynamic)
+        for (int b = 0; b < nblocks; ++b) {
+            int first = b * BLOCK;
+            int size = std::min(BLOCK, ncols - first);
+            if (fast)
+                gram.noalias() = sprep.z.middleCols(first, size).transpose() * sprep.z.rightCols(ncols - first);
+            for (int i = first; i < first + size; ++i) {
+                for (int j = i + 1; j < ncols; ++j) {
+                    double r;
+                    if (fast && !sprep.missing[i] && !sprep.missing[j]) {
+                        double ni = sprep.norm[i], nj = sprep.norm[j];
+                        double var = ni * ni + nj * nj + 2 * sign * ni * nj * gram(i - first, j - first);
+                        // constant operation
+                        if (var <= 1e-12 * (ni * ni + nj * nj)) continue;
+                        r = (ni * dots[i] + sign * nj * dots[j]) / std::sqrt(var);
+                    } else {
+                        res = Algorithm::column_operate(S, i, j, options.operation);
+                        r = func(res, T.col(k));
+                    }
+                    if (std::isnan(r)) continue;
+                    int corr = static_cast<int>(std::round(r * 1000));
+                    if (abs(corr) > threshold)
+                        local.push({(uint32_t)k, (uint32_t)i, (uint32_t)j}, {(int16_t)corr});
+                }
+            }
+        }
+        #pragma omp critical(result)
+        result.append(local);
+    }
+    return true;
+}
+
+/**
+ * @brief Stable partners of a source feature
+ *
+ * @param feature
+ * @param ratio
+ * @param result
+ * @param error
+ * @return true
+ * @return false
+ */
+bool Server::queryStable(const std::string& feature, double ratio, PairStore& result, std::string& error) {
+    int g = indexOf(source->columns, feature);
+    if (g < 0) {
+        error = "Unknown feature: " + feature;
+        return false;
+    }
+    const MatrixXd& S = source->data;
+    int srows = S.rows();
+    int lowerBound = static_cast<int>(std::ceil(ratio * srows));
+    result.reset(2, 1);
+    result.dicts = {source->columns};
+    result.keyNames = {"source", "target"};
+    result.valNames = {"ratio(source>target)"};
+    result.scales = {PairStore::countScale(srows)};
+    #pragma omp parallel
+    {
+        PairStore local = result.layout();
+        #pragma omp for schedule(static)
+        for (int j = 0; j < S.cols(); ++j) {
+            if (j == g) continue;
+            int count = (S.col(g).array() > S.col(j).array()).count();
+            if (count > lowerBound) {
+                local.push({(uint32_t)g, (uint32_t)j}, {result.encode(0, 1.0 * count / srows)});
+            } else if (srows - count > lowerBound) {
+                local.push({(uint32_t)j, (uint32_t)g}, {result.encode(0, 1.0 * (srows - count) / srows)});
+            }
+        }
+        #pragma omp critical(result)
+        result.append(local);
+    }
+    return true;
+}
+
+/**
+ * @brief Whether a source or target feature has this name
+ *
+ * @param feature
+ * @return true
+ * @return false
+ */
+bool Server::known(const std::string& feature) const {
+    return indexOf(source->columns, feature) >= 0 || (target != nullptr && indexOf(target->columns, feature) >= 0);
+}
+
+/**
+ * @brief Answer one request line
+ *
+ * @param line
+ * @return response text
+ */
+std::string Server::respond(const std::string& line) {
+    size_t blank = line.find_first_of(" \t");
+    std::string command = line.substr(0, blank);
+    std::string feature = blank == std::string::npos ? "" : Utils::strip(line.substr(blank + 1));
+    std::ostringstream os;
+    if (command == "shutdown") {
+        stopped = true;
+        return "OK 0\n\n";
+    }
+    if (command == "info") {
+        os << "samples\t" << source->data.rows() << "\n" << "source\t" << source->data.cols() << "\n";
+        if (target != nullptr)
+            os << "target\t" << target->data.cols() << "\n";
+        os << "method\t" << options.method << "\n" << "operation\t" << options.operation << "\n";
+        return "OK " + std::to_string(target != nullptr ? 5 : 4) + "\n" + os.str() + "\n";
+    }
+    if ((command != "corr" && command != "pairs" && command != "stable") || feature.empty()) {
+        return "ERROR Invalid request: " + line + "\n\n";
+    }
+    double value = command == "stable" ? options.ratio : options.threshold;
+    // feature names may have spaces (eg. "TSPAN6 (7105)"), the cutoff is a trailing number
+    // unless the whole text is the name of a feature
+    size_t last = feature.find_last_of(" \t");
+    double cutoff;
+    if (last != std::string::npos && parseNumber(feature.substr(last + 1), cutoff) && !known(feature)) {
+        value = cutoff;
+        feature = Utils::strip(feature.substr(0, last));
+    }
+    PairStore result;
+    std::string error;
+    bool success;
+    if (command == "corr") {
+        success = queryCorr(feature, value, result, error);
+    } else if (command == "pairs") {
+        success = queryPairs(feature, value, result, error);
+    } else {
+        success = queryStable(feature, value, result, error);
+    }
+    if (!success) {
+        return "ERROR " + error + "\n\n";
+    }
+    result.sort();
+    os << "OK " << result.size() << "\n";
+    result.write(os, '\t', true, options.threads);
+    os << "\n";
+    return os.str();
+}
+
+/**
+ * @brief Answer the requests of a client until it closes the connection or stays idle for
+ *        the timeout, so that an idle client does not keep the others waiting
+ *
+ * @param client
+ */
+void Server::serve(int client) {
+    std::string buffer;
+    char chunk[4096];
+    while (!stopped) {
+        size_t end = buffer.find('\n');
+        if (end == std::string::npos) {
+            ssize_t n = recv(client, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                std::cout << "[Serve] - Closed a connection idle for " << options.timeout << " s" << std::endl;
+                return;
+            }
+            if (n <= 0) return;
+            buffer.append(chunk, n);
+            continue;
+        }
+        std::string line = Utils::strip(buffer.substr(0, end));
+        buffer.erase(0, end + 1);
+        if (line.empty()) continue;
+        Timer timer = Timer();
+        std::string response = respond(line);
+        std::cout << "[Serve] - " << line << ": " << response.substr(0, response.find('\n'))
+                  << " in " << static_cast<int64_t>(timer.elapsed() * 1000) << " ms" << std::endl;
+        if (!sendAll(client, response)) return;
+    }
+}
+
+/**
+ * @brief Listen on the Unix socket and answer the clients one after another. An existing
+ *        path is only replaced when it is the socket of a server that is not running anymore.
+ *
+ * @return true
+ * @return false
+ */
+bool Server::run() {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (options.socket.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "[Serve] - Socket path is too long: " << options.socket << std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, options.socket.c_str());
+    struct stat info;
+    if (lstat(options.socket.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            std::cerr << "[Serve] - " << options.socket << " exists and is not a socket, give another path." << std::endl;
+            return false;
+        }
+        if (listening(addr)) {
+            std::cerr << "[Serve] - Another server is listening on " << options.socket << std::endl;
+            return false;
+        }
+        // stale socket of a previous server
+        if (unlink(options.socket.c_str()) != 0) {
+            std::cerr << "[Serve] - Failed to remove the stale socket " << options.socket << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "[Serve] - Failed to create the socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::cerr << "[Serve] - Failed to listen on " << options.socket << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    bound = true;
+    if (listen(fd, 16) < 0) {
+        std::cerr << "[Serve] - Failed to listen on " << options.socket << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    std::cout << "[Serve] - Listening on " << options.socket << std::endl;
+    omp_set_num_threads(options.threads);
+    while (!stopped) {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "[Serve] - Failed to accept a connection: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (options.timeout > 0) {
+            timeval timeout;
+            timeout.tv_sec = static_cast<time_t>(options.timeout);
+            timeout.tv_usec = 0;
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+        serve(client);
+        close(client);
+    }
+    std::cout << "[Serve] - Shutdown." << std::endl;
+    return true;
+}
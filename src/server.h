@@ -0,0 +1,74 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "utils.h"
+#include "timer.h"
+#include "algorithm.h"
+#include "dataframe.h"
+#include "pairstore.h"
+#include "colstats.h"
+
+struct ServeOptions
+{
+    std::string expression;
+    std::string target;
+    std::string socket;
+    std::string method;
+    std::string operation;
+    double threshold = 0.3;
+    double ratio = 0.9;
+    size_t threads = 2;
+    size_t timeout = 60;    // seconds a client may stay idle, 0 for no limit
+};
+
+/**
+ * Resident query server. The source and target data are loaded once together with the
+ * standardized columns (of the ranks for spearman), so that the correlations of one
+ * feature with all columns are a single matrix-vector product.
+ *
+ * Requests are lines on a Unix socket, the command, the feature (whose name may have spaces)
+ * and an optional trailing number, separated by tabs or spaces:
+ *   corr FEATURE [cutoff]     correlations of a source or target feature with all source features
+ *   pairs TARGET [cutoff]     source pairs whose operation is correlated with a target feature
+ *   stable FEATURE [ratio]    stable partners of a source feature
+ *   info                      dimensions of the loaded data (name, value lines)
+ *   shutdown                  stop the server
+ * The response is "OK n" followed by a header and n pair lines, or "ERROR message", and
+ * ends with an empty line. Clients are answered one after another, a client idle for the
+ * timeout is disconnected.
+ */
+class Server
+{
+private:
+    DataFrame *source = nullptr;
+    DataFrame *target = nullptr;
+    ColumnStats sprep;
+    ColumnStats tprep;
+    CorrFunc func;
+    int fd = -1;
+    bool bound = false;     // the socket file was created by this server
+
+    std::string respond(const std::string& line);
+    bool known(const std::string& feature) const;
+    bool queryCorr(const std::string& feature, double cutoff, PairStore& result, std::string& error);
+    bool queryPairs(const std::string& feature, double cutoff, PairStore& result, std::string& error);
+    bool queryStable(const std::string& feature, double ratio, PairStore& result, std::string& error);
+    void serve(int client);
+
+    bool stopped = false;
+
+public:
+    ServeOptions options;
+
+    Server(const ServeOptions& opts);
+    ~Server();
+
+    bool run();
+};
+
+#endif
@@ -1,33 +1,125 @@
+#include <numeric>
+#include <random>
+
 #include "stablepairs.h"
 
-StablePairs::StablePairs() {
-    options = new StableOptions();
+StablePairs::StablePairs() {}
+
+/**
+ * @brief Construct a new Stable Pairs object from the files of the options
+ * 
+ * @param opts
+ */
+StablePairs::StablePairs(const StableOptions& opts) : options(opts) {
+    {
+        Metrics::Phase phase("load");
+        if (options.memoryLimit > 0) {
+            if (!options.groups.empty()) {
+                throw std::invalid_argument("Sample groups need the data in memory, --memory-limit is not available.");
+            }
+            source = mapData(options.expression, options.memoryLimit << 20, options.cacheDir);
+            if (source == nullptr) {
+                throw std::invalid_argument("Failed to map the data file: " + options.expression);
+            }
+        } else {
+            source = new DataFrame(options.expression);
+        }
+        if (options.groups.empty() && !options.target.empty() && Utils::exists(options.target)) {
+            if (options.memoryLimit > 0) {
+                target = mapData(options.target, options.memoryLimit << 20, options.cacheDir);
+                if (target == nullptr) {
+                    throw std::invalid_argument("Failed to map the data file: " + options.target);
+                }
+            } else {
+                target = new DataFrame(options.target);
+            }
+        }
+    }
+    setup();
 }
-StablePairs::StablePairs(StableOptions *opts) {
-    options = opts;
-    source = new DataFrame(options->expression);
-    srows = source->data.rows();
-    lowerBound = static_cast<int>(std::ceil(options->ratio * srows));
 
-    if (options->block < 10) {
-        options->block = source->data.cols();
+/**
+ * @brief Construct a new Stable Pairs object over data frames loaded by the caller, which keeps
+ *        them and may share them between runs
+ * 
+ * @param opts
+ * @param sourceFrame
+ * @param targetFrame nullptr without target data
+ */
+StablePairs::StablePairs(const StableOptions& opts, DataFrame* sourceFrame, DataFrame* targetFrame) : options(opts) {
+    if (options.memoryLimit > 0) {
+        throw std::invalid_argument("--memory-limit needs data loaded for the run alone.");
     }
+    source = sourceFrame;
+    target = options.groups.empty() ? targetFrame : nullptr;
+    ownsData = false;
+    setup();
+}
 
-    if(!options->target.empty() and Utils::exists(options->target)) {
-        target = new DataFrame(options->target);
-        trows = target->data.rows();
-        reverseBound = static_cast<int>(std::ceil(options->revRatio * trows));
+/**
+ * @brief Views, feature names, groups and selections of the loaded data
+ * 
+ */
+void StablePairs::setup() {
+    Metrics::Phase phase("preprocess");
+    // sparse data is counted on the non-zero values, unless it is grouped, resampled or compared with dense data
+    if (source->is_sparse() && (!options.groups.empty() || options.bootstrap > 0 || (target != nullptr && !target->is_sparse()))) {
+        std::cout << "[Stable Pairs] - Sparse data is only counted as sparse alone or against sparse target data, it is converted to dense." << std::endl;
+        source->densify();
+    }
+    if (target != nullptr && target->is_sparse() && !source->is_sparse()) {
+        target->densify();
+    }
+    new (&sdata) Map<const MatrixXd>(source->view());
+    columns = source->columns;
+    if (target != nullptr)
+        new (&tdata) Map<const MatrixXd>(target->view());
+    if (source->is_sparse())
+        ssparse = &source->sparse;
+    if (target != nullptr && target->is_sparse())
+        tsparse = &target->sparse;
+    if (!options.groups.empty() && !loadGroups(options.groups)) {
+        throw std::invalid_argument("Invalid sample group file: " + options.groups);
+    }
+    init();
+    if (!options.features.empty() && !setFeatures(Utils::readList(options.features))) {
+        throw std::invalid_argument("Invalid feature list: " + options.features);
     }
 
-    if (options->output.empty()) {
-        options->output = Utils::dirname(options->expression) + "/output.txt";
+    if (options.output.empty()) {
+        options.output = Utils::dirname(options.expression) + "/output.txt";
     }
 }
+
+/**
+ * @brief Construct a new Stable Pairs object over an in-memory matrix (samples x features), the data is not copied
+ * 
+ * @param opts
+ * @param sourceData
+ */
+StablePairs::StablePairs(const StableOptions& opts, const Map<const MatrixXd>& sourceData) : options(opts) {
+    new (&sdata) Map<const MatrixXd>(sourceData);
+    init();
+}
+
+/**
+ * @brief Construct a new Stable Pairs object over in-memory matrices, pairs stable in the source data and reversed in the target data
+ * 
+ * @param opts
+ * @param sourceData
+ * @param targetData
+ */
+StablePairs::StablePairs(const StableOptions& opts, const Map<const MatrixXd>& sourceData, const Map<const MatrixXd>& targetData) : options(opts) {
+    if (sourceData.cols() != targetData.cols()) {
+        throw std::invalid_argument("The source and target data must have the same features.");
+    }
+    new (&sdata) Map<const MatrixXd>(sourceData);
+    new (&tdata) Map<const MatrixXd>(targetData);
+    init();
+}
+
 StablePairs::~StablePairs() {
-    if (options != nullptr) {
-        delete options;
-        options = nullptr;  
-    } 
+    if (!ownsData) return;
     if (source != nullptr) {
         delete source;
         source = nullptr;
@@ -38,6 +130,270 @@ StablePairs::~StablePairs() {
     }
 }
 
+/**
+ * @brief Bounds and defaults depending on the data
+ * 
+ */
+void StablePairs::init() {
+    srows = ssparse != nullptr ? ssparse->rows() : sdata.rows();
+    lowerBound = static_cast<int>(std::ceil(options.ratio * srows));
+    trows = tsparse != nullptr ? tsparse->rows() : tdata.rows();
+    reverseBound = static_cast<int>(std::ceil(options.revRatio * trows));
+
+    if (options.block < 10) {
+        options.block = sourceCols();
+    }
+    if (columns.size() != static_cast<size_t>(sourceCols())) {
+        columns.resize(sourceCols());
+        for (size_t i = 0; i < columns.size(); ++i)
+            columns[i] = std::to_string(i);
+    }
+    if (selected.size() != static_cast<size_t>(sourceCols())) {
+        featureIndex.resize(sourceCols());
+        std::iota(featureIndex.begin(), featureIndex.end(), 0);
+        selected.assign(sourceCols(), 1);
+    }
+}
+
+/**
+ * @brief Only find the pairs involving some features, the partner ranges over all features
+ * 
+ * @param names selected feature names
+ * @return true 
+ * @return false 
+ */
+bool StablePairs::setFeatures(const std::vector<std::string>& names) {
+    int missing;
+    std::vector<int> index = Utils::indexOf(columns, names, missing);
+    if (missing > 0)
+        std::cout << "[Stable Pairs] - Skip " << missing << " selected features that are not in the expression file." << std::endl;
+    if (index.empty()) {
+        std::cerr << "[Stable Pairs] - None of the selected features is in the expression file." << std::endl;
+        return false;
+    }
+    featureIndex.swap(index);
+    selected.assign(sourceCols(), 0);
+    for (int i : featureIndex)
+        selected[i] = 1;
+    std::cout << "[Stable Pairs] - Search the pairs of " << featureIndex.size() << " selected features." << std::endl;
+    return true;
+}
+
+/**
+ * @brief Deliver pairs to the sink every `batch` pairs instead of keeping them in `pairs`
+ * 
+ * @param callback called by one thread at a time, from inside the parallel region: an exception
+ *                 it throws can't be caught there and terminates the process
+ * @param batch
+ */
+void StablePairs::setSink(PairSink callback, size_t batch) {
+    sink = callback;
+    batchSize = std::max<size_t>(batch, 1);
+}
+
+/**
+ * @brief Source data read by the calling thread, the copy of its NUMA node if replicated
+ * 
+ * @return Map<const MatrixXd> 
+ */
+Map<const MatrixXd> StablePairs::sourceView() const {
+    return numa.sourceView(sdata);
+}
+
+/**
+ * @brief Target data read by the calling thread, the copy of its NUMA node if replicated
+ * 
+ * @return Map<const MatrixXd> 
+ */
+Map<const MatrixXd> StablePairs::targetView() const {
+    return numa.targetView(tdata);
+}
+
+/**
+ * @brief Columns of the blocks streamed through memory, all columns for data in memory
+ * 
+ * @return int 
+ */
+int StablePairs::blockWidth() const {
+    if (!outOfCore()) return sourceCols();
+    // the same columns of the target data are read together with the source columns
+    return tileWidth(options.memoryLimit << 20, (sdata.rows() + tdata.rows()) * sizeof(double), sdata.cols());
+}
+
+/**
+ * @brief Page the blocks of a tile in, from the source and the target data
+ * 
+ * @param previous nullptr for the first tile
+ * @param tile 
+ */
+void StablePairs::pageTile(const ColumnTile* previous, const ColumnTile& tile) const {
+    ::pageTile(source, previous, tile);
+    ::pageTile(target, previous, tile);
+}
+
+/**
+ * @brief Hand the pairs found by a thread over to the sink or to `pairs`
+ * 
+ * @param local pairs of the calling thread
+ * @param final end of the thread's work
+ */
+void StablePairs::collect(PairStore& local, bool final) {
+    if (options.summary) {
+        // each thread folds its own pairs, without waiting for the others
+        if (local.size() == 0 || (!final && local.size() < Summary::BATCH)) return;
+        summary.add(local, omp_get_thread_num());
+    } else if (sink) {
+        if (local.size() == 0 || (!final && local.size() < batchSize)) return;
+        #pragma omp critical(collect)
+        sink(local);
+    } else {
+        if (!final) return;
+        order.keep(omp_get_thread_num(), local);
+    }
+    local.clear();
+}
+
+/**
+ * @brief Note the position of the next pair of the calling thread in the loop of a tile
+ * 
+ * @param tile
+ * @param iteration iteration of the collapsed loop of the tile
+ * @param local pairs of the calling thread
+ */
+void StablePairs::mark(size_t tile, uint64_t iteration, const PairStore& local) {
+    if (!sink && !options.summary)
+        order.mark(omp_get_thread_num(), tile, iteration, local.size());
+}
+
+/**
+ * @brief Prepare the sufficient statistics of the candidate pairs
+ * 
+ * @param mode stable or reverse
+ * @param nstats counts of each pair
+ */
+void StablePairs::trackStats(const std::string& mode, size_t nstats) {
+    stats.reset(2, nstats);
+    stats.mode = mode;
+    stats.ratio = options.ratio;
+    stats.revRatio = options.revRatio;
+    stats.slack = options.slack;
+    stats.srows = srows;
+    stats.trows = trows;
+    // an update skips the samples given again
+    stats.sourceSamples = source != nullptr ? source->index : std::vector<std::string>();
+    stats.targetSamples = target != nullptr ? target->index : std::vector<std::string>();
+    stats.untracked = std::max(0.0, std::ceil((options.ratio - options.slack) * srows));
+    stats.untrackedRev = std::max(0.0, std::ceil((options.revRatio - options.slack) * trows));
+}
+
+/**
+ * @brief Group the samples, the source rows are reordered so that each group is contiguous
+ * 
+ * @param labels group of each source row, empty for samples without group
+ * @return true 
+ * @return false 
+ */
+bool StablePairs::setGroups(const std::vector<std::string>& labels) {
+    if (labels.size() != static_cast<size_t>(sdata.rows())) {
+        std::cerr << "[Stable Pairs] - The number of group labels is inconsistent with the samples." << std::endl;
+        return false;
+    }
+    std::map<std::string, int> groupOf;
+    std::vector<std::vector<int> > members;
+    groupNames.clear();
+    for (size_t r = 0; r < labels.size(); ++r) {
+        if (labels[r].empty()) continue;
+        auto group = groupOf.find(labels[r]);
+        if (group == groupOf.end()) {
+            group = groupOf.insert({labels[r], static_cast<int>(members.size())}).first;
+            groupNames.push_back(labels[r]);
+            members.push_back({});
+        }
+        members[group->second].push_back(r);
+    }
+    if (members.empty()) {
+        std::cerr << "[Stable Pairs] - No sample belongs to a group." << std::endl;
+        return false;
+    }
+    // a pair is stable in one group and reversed in another, one group gives no pair
+    if (members.size() < 2) {
+        std::cerr << "[Stable Pairs] - The samples form only one group (" << groupNames[0] << "), at least two groups are needed." << std::endl;
+        return false;
+    }
+
+    int rows = 0;
+    for (const auto& rowsOfGroup : members)
+        rows += rowsOfGroup.size();
+    MatrixXd data(rows, sdata.cols());
+    rows = 0;
+    groupStart.clear();
+    groupSize.clear();
+    groupStable.clear();
+    groupReverse.clear();
+    for (size_t g = 0; g < members.size(); ++g) {
+        int n = members[g].size();
+        groupStart.push_back(rows);
+        groupSize.push_back(n);
+        groupStable.push_back(static_cast<int>(std::ceil(options.ratio * n)));
+        groupReverse.push_back(static_cast<int>(std::ceil(options.revRatio * n)));
+        for (int r : members[g])
+            data.row(rows++) = sdata.row(r);
+        std::cout << "[Stable Pairs] - Group " << groupNames[g] << ": " << n << " samples." << std::endl;
+    }
+    grouped.swap(data);
+    new (&sdata) Map<const MatrixXd>(grouped.data(), grouped.rows(), grouped.cols());
+    init();
+    return true;
+}
+
+/**
+ * @brief Load sample groups from file
+ * 
+ * @param filename two columns file, sample name and group label, with an optional header line
+ * @return true 
+ * @return false 
+ */
+bool StablePairs::loadGroups(const std::string& filename) {
+    InputStream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "[Stable Pairs] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    char delim = Utils::getDelim(filename);
+    std::map<std::string, int> rowOf;
+    for (size_t r = 0; r < source->index.size(); ++r)
+        rowOf[source->index[r]] = r;
+
+    std::vector<std::string> labels(source->index.size());
+    std::vector<std::string> fields;
+    std::string line;
+    int skipped = 0;
+    bool first = true;
+    while (std::getline(file, line)) {
+        Utils::split(Utils::rstrip(line, "\n\r"), fields, std::string(1, delim));
+        if (fields.size() < 2) continue;
+        auto row = rowOf.find(fields[0]);
+        // a first line naming no sample is a header
+        bool header = first;
+        first = false;
+        if (row == rowOf.end()) {
+            if (!header) skipped++;
+            continue;
+        }
+        labels[row->second] = fields[1];
+    }
+    file.close();
+    if (skipped > 0)
+        std::cout << "[Stable Pairs] - Skip " << skipped << " lines whose sample is not in the expression file." << std::endl;
+    if (!setGroups(labels)) {
+        return false;
+    }
+    // the grouped copy replaces the loaded data, unless the data belongs to the caller
+    if (ownsData)
+        source->data.resize(0, 0);
+    return true;
+}
+
 /**
  * @brief Only calculate stable gene pairs
  * 
@@ -45,27 +401,69 @@ StablePairs::~StablePairs() {
  * @return false 
  */
 bool StablePairs::getPairsStable() {
-    if (source->data.rows() == 0) {
+    if (srows == 0) {
         std::cout << "[Stable Pairs] - Expression file is empty." << std::endl;
         return false;
     }
     std::cout << "[Stable Pairs] - Begin the search for stable gene pairs." << std::endl;
-    int i, j, count;
-    omp_set_num_threads(options->threads);
-    #pragma omp parallel for collapse(2) private(i, j, count) schedule(static, options->block)
-    for (i = 0; i < source->data.cols(); ++i) {
-        for (j = 0; j < source->data.cols(); ++j) {
-            if (j <= i) continue;
-            count = (source->data.col(i).array() > source->data.col(j).array()).count();
-            if (count > lowerBound) {
-                #pragma omp critical
-                pairs.push_back({i, j, count});
-            } else if (srows - count > lowerBound) {
-                #pragma omp critical
-                pairs.push_back({j, i, srows - count});
+    pairs.reset(2, 2);
+    pairs.dicts = {columns};
+    pairs.keyNames = {"source", "target"};
+    pairs.valNames = {"ratio(source>target)", "reverse(source<target)"};
+    pairs.scales = {PairStore::countScale(srows), 1};
+    int ncols = sourceCols();
+    bool track = !options.stats.empty();
+    if (track) trackStats("stable", 1);
+    int candidateBound = static_cast<int>(stats.untracked);
+    uint64_t evaluated = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    omp_set_num_threads(options.threads);
+    std::vector<ColumnTile> tiles = columnTiles(featureIndex, selected, ncols, blockWidth());
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        PairStore local = pairs.layout();
+        SuffStats localStats(2, 1);
+        for (size_t b = 0; b < tiles.size(); ++b) {
+            const ColumnTile& tile = tiles[b];
+            #pragma omp single
+            pageTile(b > 0 ? &tiles[b - 1] : nullptr, tile);
+            Timer work;
+            #pragma omp for collapse(2) schedule(static, options.block) reduction(+:evaluated, emitted) nowait
+            for (int f = tile.f0; f < tile.f1; ++f) {
+                for (int j = tile.j0; j < tile.j1; ++j) {
+                    int i = featureIndex[f];
+                    if (counted(i, j)) continue;
+                    evaluated++;
+                    int count = ssparse != nullptr ? Algorithm::sparseGreater(*ssparse, i, j) :
+                                (S.col(i).array() > S.col(j).array()).count();
+                    if (track && (count > candidateBound || srows - count > candidateBound))
+                        localStats.push({(uint32_t)i, (uint32_t)j}, {(double)count});
+                    // the pair in the order of most samples
+                    tally(0, 1.0 * std::max(count, srows - count) / srows);
+                    if (count > lowerBound) {
+                        emitted++;
+                        mark(b, (uint64_t)(f - tile.f0) * (tile.j1 - tile.j0) + (j - tile.j0), local);
+                        local.push({(uint32_t)i, (uint32_t)j}, {pairs.encode(0, 1.0 * count / srows), 0});
+                        collect(local, false);
+                    } else if (srows - count > lowerBound) {
+                        emitted++;
+                        mark(b, (uint64_t)(f - tile.f0) * (tile.j1 - tile.j0) + (j - tile.j0), local);
+                        local.push({(uint32_t)j, (uint32_t)i}, {pairs.encode(0, 1.0 * (srows - count) / srows), 0});
+                        collect(local, false);
+                    }
+                }
             }
+            busy[omp_get_thread_num()] += work.elapsed();
+            #pragma omp barrier
+        }
+        collect(local, true);
+        if (track) {
+            #pragma omp critical(stats)
+            stats.append(localStats);
         }
     }
+    Metrics::global().countPairs(evaluated, 0, 0, emitted, busy);
     std::cout << "[Stable Pairs] - Successfully calculated all stable gene pairs." << std::endl;
     return true;
 }
@@ -77,33 +475,252 @@ bool StablePairs::getPairsStable() {
  * @return false 
  */
 bool StablePairs::getPairsReverse() {
-    if (source->data.rows() == 0 || target->data.rows() == 0) {
+    if (srows == 0 || trows == 0) {
         std::cout << "[Stable Pairs] - Expression file or target file is empty." << std::endl;
         return false;
     }
 
     std::cout << "[Stable Pairs] - Begin the search for stable and reversed gene pairs." << std::endl;
-    omp_set_num_threads(options->threads);
-    int i, j, percent, rev;
-    #pragma omp parallel for collapse(2) private(i, j, percent, rev) schedule(static, options->block)
-    for (i = 0; i < source->data.cols(); ++i) {
-        for (j = 0; j < source->data.cols(); ++j) {
-            if (j <= i) continue;
-            percent = (source->data.col(i).array() > source->data.col(j).array()).count();
-            rev = (target->data.col(i).array() < target->data.col(j).array()).count();
-            if (percent > lowerBound && rev > reverseBound) {
-                #pragma omp critical
-                pairs.push_back({i, j, percent, rev});
-            } else if (srows - percent > lowerBound && trows - rev > reverseBound) {
-                #pragma omp critical
-                pairs.push_back({j, i, srows - percent, trows - rev});
+    pairs.reset(2, 2);
+    pairs.dicts = {columns};
+    pairs.keyNames = {"source", "target"};
+    pairs.valNames = {"ratio(source>target)", "reverse(source<target)"};
+    pairs.scales = {PairStore::countScale(srows), PairStore::countScale(trows)};
+    int ncols = sourceCols();
+    bool track = !options.stats.empty();
+    if (track) trackStats("reverse", 2);
+    int candidateBound = static_cast<int>(stats.untracked);
+    int candidateReverse = static_cast<int>(stats.untrackedRev);
+    uint64_t evaluated = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    omp_set_num_threads(options.threads);
+    std::vector<ColumnTile> tiles = columnTiles(featureIndex, selected, ncols, blockWidth());
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        const Map<const MatrixXd> T = targetView();
+        PairStore local = pairs.layout();
+        SuffStats localStats(2, 2);
+        for (size_t b = 0; b < tiles.size(); ++b) {
+            const ColumnTile& tile = tiles[b];
+            #pragma omp single
+            pageTile(b > 0 ? &tiles[b - 1] : nullptr, tile);
+            Timer work;
+            #pragma omp for collapse(2) schedule(static, options.block) reduction(+:evaluated, emitted) nowait
+            for (int f = tile.f0; f < tile.f1; ++f) {
+                for (int j = tile.j0; j < tile.j1; ++j) {
+                    int i = featureIndex[f];
+                    if (counted(i, j)) continue;
+                    evaluated++;
+                    int percent, rev;
+                    if (ssparse != nullptr) {
+                        percent = Algorithm::sparseGreater(*ssparse, i, j);
+                        rev = Algorithm::sparseGreater(*tsparse, j, i);
+                    } else {
+                        percent = (S.col(i).array() > S.col(j).array()).count();
+                        rev = (T.col(i).array() < T.col(j).array()).count();
+                    }
+                    if (track && ((percent > candidateBound && rev > candidateReverse) ||
+                                  (srows - percent > candidateBound && trows - rev > candidateReverse)))
+                        localStats.push({(uint32_t)i, (uint32_t)j}, {(double)percent, (double)rev});
+                    bool forward = percent >= srows - percent;
+                    tally(0, 1.0 * (forward ? percent : srows - percent) / srows);
+                    tally(1, 1.0 * (forward ? rev : trows - rev) / trows);
+                    if (percent > lowerBound && rev > reverseBound) {
+                        emitted++;
+                        mark(b, (uint64_t)(f - tile.f0) * (tile.j1 - tile.j0) + (j - tile.j0), local);
+                        local.push({(uint32_t)i, (uint32_t)j}, {pairs.encode(0, 1.0 * percent / srows), pairs.encode(1, 1.0 * rev / trows)});
+                        collect(local, false);
+                    } else if (srows - percent > lowerBound && trows - rev > reverseBound) {
+                        emitted++;
+                        mark(b, (uint64_t)(f - tile.f0) * (tile.j1 - tile.j0) + (j - tile.j0), local);
+                        local.push({(uint32_t)j, (uint32_t)i}, {pairs.encode(0, 1.0 * (srows - percent) / srows), pairs.encode(1, 1.0 * (trows - rev) / trows)});
+                        collect(local, false);
+                    }
+                }
             }
+            busy[omp_get_thread_num()] += work.elapsed();
+            #pragma omp barrier
+        }
+        collect(local, true);
+        if (track) {
+            #pragma omp critical(stats)
+            stats.append(localStats);
         }
     }
+    Metrics::global().countPairs(evaluated, 0, 0, emitted, busy);
     std::cout << "[Stable Pairs] - Successfully calculated all stable and reverse gene pairs." << std::endl;
     return true;
 }
 
+/**
+ * @brief Calculate gene pairs that are stable in some sample groups and reversed in others,
+ *        all groups are counted in a single sweep over the samples of each pair
+ * 
+ * @return true 
+ * @return false 
+ */
+bool StablePairs::getPairsGroups() {
+    if (sdata.rows() == 0) {
+        std::cout << "[Stable Pairs] - Expression file is empty." << std::endl;
+        return false;
+    }
+    std::cout << "[Stable Pairs] - Begin the search for stable and reversed gene pairs in " << groupNames.size() << " groups." << std::endl;
+    int ngroups = groupNames.size();
+    pairs.reset(2, ngroups);
+    pairs.dicts = {columns};
+    pairs.keyNames = {"source", "target"};
+    for (int g = 0; g < ngroups; ++g) {
+        // ratio of source > target in each group
+        pairs.valNames[g] = "ratio(" + groupNames[g] + ")";
+        pairs.scales[g] = PairStore::countScale(groupSize[g]);
+    }
+    int ncols = sdata.cols();
+    int nfeatures = featureIndex.size();
+    uint64_t evaluated = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    omp_set_num_threads(options.threads);
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        PairStore local = pairs.layout();
+        // counts[g] is the number of samples with feature i > feature j in group g
+        std::vector<int> counts(ngroups);
+        std::vector<int16_t> values(ngroups);
+        Timer work;
+        #pragma omp for collapse(2) schedule(static, options.block) reduction(+:evaluated, emitted) nowait
+        for (int f = 0; f < nfeatures; ++f) {
+            for (int j = 0; j < ncols; ++j) {
+                int i = featureIndex[f];
+                if (counted(i, j)) continue;
+                evaluated++;
+                bool stable = false, reverse = false, stableRev = false, reverseRev = false;
+                for (int g = 0; g < ngroups; ++g) {
+                    int count = (S.col(i).segment(groupStart[g], groupSize[g]).array() > \
+                                S.col(j).segment(groupStart[g], groupSize[g]).array()).count();
+                    counts[g] = count;
+                    stable |= count > groupStable[g];
+                    reverse |= groupSize[g] - count > groupReverse[g];
+                    stableRev |= groupSize[g] - count > groupStable[g];
+                    reverseRev |= count > groupReverse[g];
+                }
+                bool flip = !(stable && reverse) && stableRev && reverseRev;
+                for (int g = 0; g < ngroups; ++g)
+                    tally(g, 1.0 * (flip ? groupSize[g] - counts[g] : counts[g]) / groupSize[g]);
+                if (stable && reverse) {
+                    uint32_t keys[2] = {(uint32_t)i, (uint32_t)j};
+                    for (int g = 0; g < ngroups; ++g)
+                        values[g] = pairs.encode(g, 1.0 * counts[g] / groupSize[g]);
+                    emitted++;
+                    mark(0, (uint64_t)f * ncols + j, local);
+                    local.push(keys, values.data());
+                    collect(local, false);
+                } else if (stableRev && reverseRev) {
+                    uint32_t keys[2] = {(uint32_t)j, (uint32_t)i};
+                    for (int g = 0; g < ngroups; ++g)
+                        values[g] = pairs.encode(g, 1.0 * (groupSize[g] - counts[g]) / groupSize[g]);
+                    emitted++;
+                    mark(0, (uint64_t)f * ncols + j, local);
+                    local.push(keys, values.data());
+                    collect(local, false);
+                }
+            }
+        }
+        busy[omp_get_thread_num()] += work.elapsed();
+        collect(local, true);
+    }
+    Metrics::global().countPairs(evaluated, 0, 0, emitted, busy);
+    std::cout << "[Stable Pairs] - Successfully calculated all stable and reverse gene pairs of groups." << std::endl;
+    return true;
+}
+
+/**
+ * @brief Calculate the selection frequency of stable gene pairs over bootstrap resamples of
+ *        the samples. A resample is a multiplicity of each sample (multinomial, as many draws
+ *        as samples), the comparisons of a pair are counted once and weighted for all resamples.
+ * 
+ * @return true 
+ * @return false 
+ */
+bool StablePairs::getPairsBootstrap() {
+    if (srows == 0) {
+        std::cout << "[Stable Pairs] - Expression file is empty." << std::endl;
+        return false;
+    }
+    int nboot = options.bootstrap;
+    std::cout << "[Stable Pairs] - Begin the search for stable gene pairs in " << nboot << " bootstrap resamples." << std::endl;
+    pairs.reset(2, 2);
+    pairs.dicts = {columns};
+    pairs.keyNames = {"source", "target"};
+    pairs.valNames = {"ratio(source>target)", "frequency"};
+    pairs.scales = {PairStore::countScale(srows), PairStore::countScale(nboot)};
+    // weights(b, r) is the number of times sample r is drawn in resample b, fixed seed for reproducible runs
+    MatrixXd weights = MatrixXd::Zero(nboot, srows);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> draw(0, srows - 1);
+    for (int b = 0; b < nboot; ++b)
+        for (int r = 0; r < srows; ++r)
+            weights(b, draw(rng))++;
+    // a pair is written if it is selected in at least one resample and at least minFrequency of them
+    int minSelected = std::max(1, static_cast<int>(std::ceil(options.minFrequency * nboot - 1e-9)));
+    int ncols = sourceCols();
+    uint64_t evaluated = 0, emitted = 0;
+    std::vector<double> busy(options.threads, 0);
+    omp_set_num_threads(options.threads);
+    std::vector<ColumnTile> tiles = columnTiles(featureIndex, selected, ncols, blockWidth());
+    #pragma omp parallel
+    {
+        const Map<const MatrixXd> S = sourceView();
+        PairStore local = pairs.layout();
+        VectorXd greater(srows), counts(nboot);
+        for (size_t b = 0; b < tiles.size(); ++b) {
+            const ColumnTile& tile = tiles[b];
+            #pragma omp single
+            pageTile(b > 0 ? &tiles[b - 1] : nullptr, tile);
+            Timer work;
+            #pragma omp for collapse(2) schedule(static, options.block) reduction(+:evaluated, emitted) nowait
+            for (int f = tile.f0; f < tile.f1; ++f) {
+                for (int j = tile.j0; j < tile.j1; ++j) {
+                    int i = featureIndex[f];
+                    if (counted(i, j)) continue;
+                    evaluated++;
+                    // the comparisons of all samples, weighted by each resample in one product
+                    greater = (S.col(i).array() > S.col(j).array()).cast<double>();
+                    counts.noalias() = weights * greater;
+                    int count = static_cast<int>(greater.sum());
+                    int stable = 0, reverse = 0;
+                    for (int r = 0; r < nboot; ++r) {
+                        stable += counts[r] > lowerBound;
+                        reverse += srows - counts[r] > lowerBound;
+                    }
+                    bool forward = count >= srows - count;
+                    tally(0, 1.0 * (forward ? count : srows - count) / srows);
+                    tally(1, 1.0 * (forward ? stable : reverse) / nboot);
+                    uint64_t iteration = (uint64_t)(f - tile.f0) * (tile.j1 - tile.j0) + (j - tile.j0);
+                    if (stable >= minSelected) {
+                        emitted++;
+                        mark(b, iteration, local);
+                        local.push({(uint32_t)i, (uint32_t)j}, {pairs.encode(0, 1.0 * count / srows), pairs.encode(1, 1.0 * stable / nboot)});
+                        collect(local, false);
+                    }
+                    if (reverse >= minSelected) {
+                        emitted++;
+                        mark(b, iteration, local);
+                        local.push({(uint32_t)j, (uint32_t)i}, {pairs.encode(0, 1.0 * (srows - count) / srows), pairs.encode(1, 1.0 * reverse / nboot)});
+                        collect(local, false);
+                    }
+                }
+            }
+            busy[omp_get_thread_num()] += work.elapsed();
+            #pragma omp barrier
+        }
+        collect(local, true);
+    }
+    Metrics::global().countPairs(evaluated, 0, 0, emitted, busy);
+    std::cout << "[Stable Pairs] - Successfully calculated the selection frequency of stable gene pairs." << std::endl;
+    return true;
+}
+
 /**
  * @brief Find stable gene pairs
  * 
@@ -113,15 +730,138 @@ bool StablePairs::getPairsReverse() {
 bool StablePairs::getPairs() {
     bool success;
     Timer timer = Timer();
-    if (target != nullptr) {
-        success = getPairsReverse();
-    } else {
-        success = getPairsStable();
+    if (options.numa) {
+        Metrics::Phase phase("preprocess");
+        numa.place(options.threads, sdata, tdata, "Stable Pairs");
+    }
+    if (options.summary) {
+        if (Utils::endsWith(options.output, ".gpb")) {
+            std::cerr << "[Stable Pairs] - The summary is written as text, give a text output with -o." << std::endl;
+            return false;
+        }
+        summary.reset(options.threads);
+    }
+    order.reset(options.threads, options.block);
+    if (outOfCore()) {
+        std::cout << "[Stable Pairs] - The data stays on disk, blocks of " << blockWidth() << " features are streamed through memory." << std::endl;
+    }
+    if (!groupNames.empty() && !options.stats.empty()) {
+        std::cerr << "[Stable Pairs] - Sufficient statistics are not available for sample groups." << std::endl;
+        return false;
+    }
+    if (options.bootstrap > 0) {
+        if (!groupNames.empty() || tdata.size() > 0 || tsparse != nullptr) {
+            std::cerr << "[Stable Pairs] - Bootstrap resamples are only drawn for stable pairs of one data file, without --target or --groups." << std::endl;
+            return false;
+        }
+        if (!options.stats.empty()) {
+            std::cerr << "[Stable Pairs] - Sufficient statistics are not available for bootstrap resamples." << std::endl;
+            return false;
+        }
+    }
+    {
+        Metrics::Phase phase("compute", options.threads);
+        if (options.bootstrap > 0) {
+            success = getPairsBootstrap();
+        } else if (!groupNames.empty()) {
+            success = getPairsGroups();
+        } else if (tdata.size() > 0 || tsparse != nullptr) {
+            success = getPairsReverse();
+        } else {
+            success = getPairsStable();
+        }
+    }
+    // pairs of the threads in the order of a sequential run
+    if (success) {
+        Metrics::Phase phase("merge");
+        order.concat(pairs);
+    }
+    if (success && !options.stats.empty()) {
+        Metrics::Phase phase("write");
+        stats.layout = pairs.layout();
+        stats.layout.dicts = pairs.dicts;
+        success = stats.save(options.stats);
+        std::cout << "[Stable Pairs] - Saved the statistics of " << stats.size() << " candidate pairs to " << options.stats << std::endl;
     }
     std::cout << "[Stable Pairs] - The calculation time is: " << timer << std::endl;
     return success;
 }
 
+/**
+ * @brief Estimate the run without computing it: the pairs are counted and a random sample
+ *        of them is counted on one thread
+ * 
+ * @return true 
+ * @return false 
+ */
+bool StablePairs::plan() {
+    Metrics::Phase phase("plan");
+    if (options.bootstrap > 0) {
+        std::cerr << "[Stable Pairs] - Bootstrap runs are not estimated, plan the run without --bootstrap." << std::endl;
+        return false;
+    }
+    uint64_t nf = featureIndex.size(), ncols = sourceCols();
+    int ngroups = groupNames.size();
+    bool reverse = ngroups == 0 && (tdata.size() > 0 || tsparse != nullptr);
+    if (srows == 0 || nf == 0 || (reverse && trows == 0)) {
+        std::cerr << "[Stable Pairs] - Nothing to evaluate." << std::endl;
+        return false;
+    }
+    Plan plan;
+    plan.threads = options.threads;
+    plan.binary = Utils::endsWith(options.output, ".gpb");
+    plan.stored = !sink && !options.summary;
+    plan.units = Plan::pairUnits(nf, ncols);
+    if (outOfCore()) {
+        plan.dataBytes = options.memoryLimit * 1048576.0;
+    } else {
+        plan.dataBytes = ssparse != nullptr ? ssparse->nonZeros() * 12.0 : sdata.size() * 8.0;
+        plan.dataBytes += tsparse != nullptr ? tsparse->nonZeros() * 12.0 : tdata.size() * 8.0;
+    }
+    // results: feature names, delimiters and ratios of 8 characters
+    size_t nvals = ngroups > 0 ? ngroups : 2;
+    plan.recordBytes = 4.0 * 2 + 2.0 * nvals;
+    plan.lineBytes = options.summary ? 0 : 2 * Plan::meanLength(columns) + 1 + 9.0 * nvals + 1;
+
+    std::mt19937_64 rng(42);
+    uint64_t n = std::min<uint64_t>(plan.units, Plan::SAMPLE);
+    Timer timer;
+    for (uint64_t draws = 0; plan.sampled < n && draws < 100 * n; ++draws) {
+        int i = featureIndex[rng() % nf];
+        int j = rng() % ncols;
+        if (counted(i, j)) continue;
+        bool hit = false;
+        if (ngroups > 0) {
+            bool stable = false, reversed = false, stableRev = false, reversedRev = false;
+            for (int g = 0; g < ngroups; ++g) {
+                int count = (sdata.col(i).segment(groupStart[g], groupSize[g]).array() >
+                             sdata.col(j).segment(groupStart[g], groupSize[g]).array()).count();
+                stable |= count > groupStable[g];
+                reversed |= groupSize[g] - count > groupReverse[g];
+                stableRev |= groupSize[g] - count > groupStable[g];
+                reversedRev |= count > groupReverse[g];
+            }
+            hit = (stable && reversed) || (stableRev && reversedRev);
+        } else {
+            int count = ssparse != nullptr ? Algorithm::sparseGreater(*ssparse, i, j) :
+                        (sdata.col(i).array() > sdata.col(j).array()).count();
+            if (reverse) {
+                int rev = tsparse != nullptr ? Algorithm::sparseGreater(*tsparse, j, i) :
+                          (tdata.col(i).array() < tdata.col(j).array()).count();
+                hit = (count > lowerBound && rev > reverseBound) || (srows - count > lowerBound && trows - rev > reverseBound);
+            } else {
+                hit = count > lowerBound || srows - count > lowerBound;
+            }
+        }
+        plan.sampled++;
+        if (hit)
+            plan.hits++;
+    }
+    plan.seconds = timer.elapsed();
+    plan.report("Stable Pairs");
+    return true;
+}
+
 /**
  * @brief Write gene pairs to file
  * 
@@ -129,27 +869,32 @@ bool StablePairs::getPairs() {
  * @return false 
  */
 bool StablePairs::writePairs() {
-    std::ofstream outputFile(options->output);
-    if (!outputFile.is_open()) {
-        std::cerr << "[Stable Pairs] - Failed to open file." << std::endl;
-        return false;
+    Metrics::Phase phase("write");
+    if (options.summary) {
+        std::cout << "[Stable Pairs] - Total number of gene pairs: " << summary.size() << std::endl;
+        return summary.write(options.output, pairs, options.threads);
     }
     std::cout << "[Stable Pairs] - Total number of gene pairs: " << pairs.size() << std::endl;
-    char outDelim = Utils::getDelim(options->output);
-    std::cout << "[Stable Pairs] - Start writing the results to " << options->output << std::endl;
-    outputFile << "source" << outDelim << "target" << outDelim << "ratio(source>target)" << outDelim << "reverse(source<target)\n";
-    if (target != nullptr) {
-        for (const auto& pair : pairs) {
-            outputFile << source->columns[pair[0]] << outDelim << source->columns[pair[1]] << outDelim << 1.0 * pair[2] / srows \
-                << outDelim << 1.0 * pair[3] / trows << "\n";
+    if (options.sort) {
+        Metrics::Phase sorting("sort");
+        pairs.sort();
+    }
+    std::cout << "[Stable Pairs] - Start writing the results to " << options.output << std::endl;
+    if (Utils::endsWith(options.output, ".gpb")) {
+        if (!pairs.save(options.output)) {
+            std::cerr << "[Stable Pairs] - Failed to write file." << std::endl;
+            return false;
         }
     } else {
-        for (const auto& pair : pairs) {
-            outputFile << source->columns[pair[0]] << outDelim << source->columns[pair[1]] << outDelim << 1.0 * pair[2] / srows << outDelim << "0\n";
+        OutputStream outputFile(options.output, options.threads);
+        if (!outputFile.is_open()) {
+            std::cerr << "[Stable Pairs] - Failed to open file." << std::endl;
+            return false;
         }
+        pairs.write(outputFile, Utils::getDelim(options.output), true, options.threads);
+        // 关闭文件
+        outputFile.close();
     }
-    // 关闭文件
-    outputFile.close();
     std::cout << "[Stable Pairs] - Writing is completed." << std::endl;
     return true;
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #ifndef GENEPAIRS_H
 #define GENEPAIRS_H
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -9,16 +10,35 @@
 #include "timer.h"
 #include "utils.h"
 #include "dataframe.h"
+#include "pairstore.h"
+#include "numa.h"
+#include "suffstats.h"
+#include "tiles.h"
+#include "summary.h"
+#include "plan.h"
+#include "metrics.h"
 
 
 struct StableOptions {
     std::string expression;
     std::string target;
+    std::string groups;
+    std::string features;
     std::string output;
     double ratio = 0.9;
     double revRatio = 0.6;
     size_t block = 0;
     size_t threads = 2;
+    std::string stats;      // save the sufficient statistics of the candidate pairs
+    double slack = 0.1;     // candidates pass the ratios lowered by slack
+    size_t memoryLimit = 0; // MB of data kept in memory, the rest stays on disk, 0 for no limit
+    std::string cacheDir;   // binary matrices converted for memoryLimit, next to the data files if empty
+    size_t bootstrap = 0;       // resamples of the samples, the pairs get their selection frequency
+    double minFrequency = 0;    // lowest selection frequency of the pairs written with bootstrap
+    bool summary = false;       // only keep the distribution of the pairs
+    bool plan = false;          // only estimate the work, memory and output of the run
+    bool sort = false;
+    bool numa = false;
 };
 
 class StablePairs
@@ -26,25 +46,91 @@ class StablePairs
 private:
     bool getPairsStable();
     bool getPairsReverse();
+    bool getPairsGroups();
+    bool getPairsBootstrap();
+    bool loadGroups(const std::string& filename);
+    void collect(PairStore& local, bool final);
+    // the histograms of a summary count every evaluated pair, not only the pairs passing
+    void tally(size_t column, double value) { if (options.summary) summary.tally(omp_get_thread_num(), column, value); }
+
+    // pairs kept in `pairs` are concatenated in the order of the loops
+    TileOrder order;
+    void mark(size_t tile, uint64_t iteration, const PairStore& local);
+    void trackStats(const std::string& mode, size_t nstats);
 
     int srows;         // The number of samples in the source data
     int trows;         // The number of samples in the target data
     int lowerBound;    // Lower bound for stable pairs, ratio * srows
     int reverseBound;  // Lower bound for reverse pairs, revRatio * trows
 
+    // Samples of each group are stored contiguously in `grouped`
+    MatrixXd grouped;
+    std::vector<int> groupStart;    // First row of each group
+    std::vector<int> groupSize;     // The number of samples in each group
+    std::vector<int> groupStable;   // Lower bound for stable pairs of each group
+    std::vector<int> groupReverse;  // Lower bound for reverse pairs of each group
+
+    // features enumerated as the first element of the pairs, all by default
+    std::vector<int> featureIndex;
+    std::vector<char> selected;
+    // the pair was already enumerated from feature j
+    bool counted(int i, int j) const { return j == i || (j < i && selected[j]); }
+
+    PairSink sink;
+    size_t batchSize = 0;
+
+    // copies of the data on each NUMA node, empty without --numa
+    Numa numa;
+    Map<const MatrixXd> sourceView() const;
+    Map<const MatrixXd> targetView() const;
+
+    // sparse data, pairs of zeros are not compared
+    const SparseMatrix<double>* ssparse = nullptr;
+    const SparseMatrix<double>* tsparse = nullptr;
+    Index sourceCols() const { return ssparse != nullptr ? ssparse->cols() : sdata.cols(); }
+
+    // the data is mapped and streamed in column blocks under --memory-limit
+    bool outOfCore() const { return source != nullptr && source->is_mapped(); }
+    int blockWidth() const;
+    void pageTile(const ColumnTile* previous, const ColumnTile& tile) const;
+
+    void init();
+    void setup();
+
+    // source and target are deleted with the engine unless they belong to the caller
+    bool ownsData = true;
+
 public:
 
     DataFrame *source = nullptr;
-    DataFrame *target = nullptr;    
-    StableOptions *options = nullptr;
-    std::vector<std::vector<int>> pairs;
+    DataFrame *target = nullptr;
+    StableOptions options;
+    std::vector<std::string> columns;  // feature names
+    std::vector<std::string> groupNames;
+    PairStore pairs;
+    SuffStats stats;   // only filled with options.stats
+    Summary summary;   // only filled with options.summary, instead of pairs
+
+    // views of the source and target data, no copy of the caller's buffers
+    Map<const MatrixXd> sdata{nullptr, 0, 0};
+    Map<const MatrixXd> tdata{nullptr, 0, 0};
 
     StablePairs();
-    StablePairs(StableOptions* opts);
+    StablePairs(const StableOptions& opts);
+    StablePairs(const StableOptions& opts, const Map<const MatrixXd>& sourceData);
+    StablePairs(const StableOptions& opts, const Map<const MatrixXd>& sourceData, const Map<const MatrixXd>& targetData);
+    StablePairs(const StableOptions& opts, DataFrame* sourceFrame, DataFrame* targetFrame);
     ~StablePairs();
+    // owns the loaded frames and maps its own matrices, a copy would delete them twice
+    StablePairs(const StablePairs&) = delete;
+    StablePairs& operator=(const StablePairs&) = delete;
 
+    bool setGroups(const std::vector<std::string>& labels);
+    bool setFeatures(const std::vector<std::string>& names);
+    void setSink(PairSink callback, size_t batch=1 << 16);
 
     bool getPairs();
     bool writePairs();
+    bool plan();
 };
-#endif
\ No newline at end of file
+#endif
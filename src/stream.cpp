@@ -0,0 +1,387 @@
+#include <exception>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "utils.h"
+#include "stream.h"
+
+namespace {
+    const size_t CHUNK_SIZE = 1 << 20;   // size of the chunks read from the file
+    const size_t MAX_CHUNKS = 8;         // decompressed chunks buffered ahead of the reader
+    const size_t BLOCK_SIZE = 4 << 20;   // size of the blocks compressed independently
+
+    /**
+     * @brief Compress one block into a complete gzip member or zstd frame
+     */
+    std::string compressBlock(Codec codec, const std::string& data) {
+        std::string out;
+        if (codec == Codec::Gzip) {
+            z_stream zs = {};
+            deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+            out.resize(deflateBound(&zs, data.size()));
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            zs.avail_in = data.size();
+            zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+            zs.avail_out = out.size();
+            int ret = deflate(&zs, Z_FINISH);
+            out.resize(zs.total_out);
+            deflateEnd(&zs);
+            if (ret != Z_STREAM_END) {
+                throw std::runtime_error("gzip compression error");
+            }
+        }
+#ifdef HAVE_ZSTD
+        if (codec == Codec::Zstd) {
+            out.resize(ZSTD_compressBound(data.size()));
+            size_t size = ZSTD_compress(&out[0], out.size(), data.data(), data.size(), 3);
+            if (ZSTD_isError(size)) {
+                throw std::runtime_error(std::string("zstd compression error: ") + ZSTD_getErrorName(size));
+            }
+            out.resize(size);
+        }
+#endif
+        return out;
+    }
+
+    Codec detectCodec(FILE* file) {
+        unsigned char magic[4] = {0};
+        size_t n = fread(magic, 1, sizeof(magic), file);
+        rewind(file);
+        if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+            return Codec::Gzip;
+        }
+        if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+            return Codec::Zstd;
+        }
+        return Codec::Plain;
+    }
+
+    void checkCodec(Codec codec, const std::string& filename) {
+#ifndef HAVE_ZSTD
+        if (codec == Codec::Zstd) {
+            throw Utils::FileFormatError("zstd support is not compiled in (build with ZSTD=1): " + filename);
+        }
+#endif
+    }
+}
+
+/**
+ * @brief Compression of an output file from its suffix
+ *
+ * @param filename
+ * @return Codec
+ */
+Codec codecOf(const std::string& filename) {
+    if (Utils::endsWith(filename, ".gz")) {
+        return Codec::Gzip;
+    } else if (Utils::endsWith(filename, ".zst")) {
+        return Codec::Zstd;
+    }
+    return Codec::Plain;
+}
+
+// ReadBuf
+ReadBuf::ReadBuf(FILE* file, Codec codec) : file(file), codec(codec) {
+    worker = std::thread(&ReadBuf::run, this);
+}
+
+ReadBuf::~ReadBuf() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stop = true;
+    }
+    ready.notify_all();
+    worker.join();
+}
+
+ReadBuf::int_type ReadBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return done || !chunks.empty(); });
+        if (chunks.empty()) {
+            // the istream catches it and turns bad
+            if (!failure.empty()) throw std::runtime_error(failure);
+            return traits_type::eof();
+        }
+        current.swap(chunks.front());
+        chunks.pop_front();
+    }
+    ready.notify_all();
+    setg(&current[0], &current[0], &current[0] + current.size());
+    return traits_type::to_int_type(*gptr());
+}
+
+/**
+ * @brief Why the file could not be read to its end
+ *
+ * @return empty if the file was read without error so far
+ */
+std::string ReadBuf::error() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return failure;
+}
+
+/**
+ * @brief Hand a chunk over to the reader, waits while the reader is far behind
+ *
+ * @param chunk
+ * @return false if the stream is closed
+ */
+bool ReadBuf::emit(std::string& chunk) {
+    if (chunk.empty()) return true;
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] { return stop || chunks.size() < MAX_CHUNKS; });
+    if (stop) return false;
+    chunks.push_back(std::move(chunk));
+    chunk = std::string();
+    lock.unlock();
+    ready.notify_all();
+    return true;
+}
+
+void ReadBuf::run() {
+    std::vector<char> in(CHUNK_SIZE);
+    std::string out;
+    std::string error;
+    bool ok = true;
+    size_t n;
+    if (codec == Codec::Plain) {
+        while (ok && (n = fread(in.data(), 1, in.size(), file)) > 0) {
+            out.assign(in.data(), n);
+            ok = emit(out);
+        }
+    } else if (codec == Codec::Gzip) {
+        z_stream zs = {};
+        inflateInit2(&zs, 15 + 32);
+        bool ended = false;     // the last gzip member was complete
+        while (ok && error.empty() && (n = fread(in.data(), 1, in.size(), file)) > 0) {
+            zs.next_in = reinterpret_cast<Bytef*>(in.data());
+            zs.avail_in = n;
+            // a full output chunk may leave decompressed data behind the consumed input
+            bool full = false;
+            while (ok && (zs.avail_in > 0 || full)) {
+                out.resize(CHUNK_SIZE);
+                zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+                zs.avail_out = out.size();
+                int ret = inflate(&zs, Z_NO_FLUSH);
+                if (ret == Z_BUF_ERROR && zs.avail_in == 0) break;
+                if (ret != Z_OK && ret != Z_STREAM_END) {
+                    error = "gzip data is corrupted";
+                    break;
+                }
+                full = zs.avail_out == 0;
+                out.resize(out.size() - zs.avail_out);
+                ok = emit(out);
+                ended = ret == Z_STREAM_END;
+                // concatenated gzip members
+                if (ended) {
+                    inflateReset(&zs);
+                }
+            }
+        }
+        if (ok && error.empty() && !ended && !ferror(file)) {
+            error = "gzip data is truncated";
+        }
+        inflateEnd(&zs);
+    }
+#ifdef HAVE_ZSTD
+    else if (codec == Codec::Zstd) {
+        ZSTD_DStream* zs = ZSTD_createDStream();
+        ZSTD_initDStream(zs);
+        size_t hint = 1;        // 0 once the last zstd frame is complete and flushed
+        while (ok && error.empty() && (n = fread(in.data(), 1, in.size(), file)) > 0) {
+            ZSTD_inBuffer input = {in.data(), n, 0};
+            bool full = false;
+            while (ok && (input.pos < input.size || full)) {
+                out.resize(CHUNK_SIZE);
+                ZSTD_outBuffer output = {&out[0], out.size(), 0};
+                hint = ZSTD_decompressStream(zs, &output, &input);
+                if (ZSTD_isError(hint)) {
+                    error = std::string("zstd data is corrupted: ") + ZSTD_getErrorName(hint);
+                    break;
+                }
+                full = output.pos == output.size;
+                out.resize(output.pos);
+                ok = emit(out);
+            }
+        }
+        if (ok && error.empty() && hint != 0 && !ferror(file)) {
+            error = "zstd data is truncated";
+        }
+        ZSTD_freeDStream(zs);
+    }
+#endif
+    if (ok && error.empty() && ferror(file)) {
+        error = "failed to read the file";
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        failure = error;
+        done = true;
+    }
+    ready.notify_all();
+}
+
+// WriteBuf
+WriteBuf::WriteBuf(FILE* file, Codec codec, size_t threads)
+    : file(file), codec(codec), pool(codec == Codec::Plain ? 0 : std::max<size_t>(threads, 1)),
+      maxPending(2 * std::max<size_t>(threads, 1)), block(BLOCK_SIZE) {
+    setp(block.data(), block.data() + block.size());
+}
+
+WriteBuf::~WriteBuf() {
+    // errors are reported by an explicit close(), a destructor must not throw
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+WriteBuf::int_type WriteBuf::overflow(int_type ch) {
+    submit();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return failed ? traits_type::eof() : traits_type::not_eof(ch);
+}
+
+/**
+ * @brief Flush plain output, compressed blocks are only cut when full or at close,
+ *        so that flushing (eg. std::endl) does not produce tiny members
+ *
+ * @return int
+ */
+int WriteBuf::sync() {
+    if (codec == Codec::Plain) {
+        submit();
+        fflush(file);
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Flush all data and close the file, a compression error is rethrown once the file
+ *        is closed
+ *
+ * @return true
+ * @return false
+ */
+bool WriteBuf::close() {
+    if (file == nullptr) return !failed;
+    std::exception_ptr error;
+    try {
+        submit();
+        while (!pending.empty()) {
+            writeFront();
+        }
+    } catch (...) {
+        error = std::current_exception();
+        failed = true;
+        pending.clear();
+    }
+    pool.shutdown();
+    failed |= fclose(file) != 0;
+    file = nullptr;
+    if (error) std::rethrow_exception(error);
+    return !failed;
+}
+
+/**
+ * @brief Move the buffered data to the compression queue (or to the file for plain output)
+ *
+ */
+void WriteBuf::submit() {
+    size_t size = pptr() - pbase();
+    if (size == 0) return;
+    if (codec == Codec::Plain) {
+        failed |= fwrite(pbase(), 1, size, file) != size;
+    } else {
+        pending.push_back(pool.enqueue(compressBlock, codec, std::string(pbase(), size)));
+        while (pending.size() > maxPending) {
+            writeFront();
+        }
+    }
+    setp(block.data(), block.data() + block.size());
+}
+
+void WriteBuf::writeFront() {
+    std::string data = pending.front().get();
+    pending.pop_front();
+    failed |= fwrite(data.data(), 1, data.size(), file) != data.size();
+}
+
+// InputStream
+InputStream::InputStream(const std::string& filename) : std::istream(nullptr) {
+    file = fopen(filename.c_str(), "rb");
+    if (file == nullptr) {
+        setstate(std::ios::failbit);
+        return;
+    }
+    Codec codec = detectCodec(file);
+    try {
+        checkCodec(codec, filename);
+    } catch (...) {
+        // the destructor does not run for a constructor that throws
+        fclose(file);
+        file = nullptr;
+        throw;
+    }
+    buf.reset(new ReadBuf(file, codec));
+    rdbuf(buf.get());
+}
+
+InputStream::~InputStream() {
+    close();
+}
+
+void InputStream::close() {
+    // stop the reader thread before closing the file
+    buf.reset();
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+// OutputStream
+OutputStream::OutputStream(const std::string& filename, size_t threads, bool append) : std::ostream(nullptr) {
+    Codec codec = codecOf(filename);
+    checkCodec(codec, filename);
+    // compressed data is appended as a new gzip member / zstd frame
+    file = fopen(filename.c_str(), append ? "ab" : "wb");
+    if (file == nullptr) {
+        setstate(std::ios::failbit);
+        return;
+    }
+    buf.reset(new WriteBuf(file, codec, threads));
+    rdbuf(buf.get());
+}
+
+OutputStream::~OutputStream() {
+    // errors are reported by an explicit close(), a destructor must not throw
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+bool OutputStream::close() {
+    if (file == nullptr) return true;
+    file = nullptr;
+    bool success = false;
+    try {
+        success = buf->close();
+    } catch (...) {
+        setstate(std::ios::badbit);
+        throw;
+    }
+    if (!success) setstate(std::ios::badbit);
+    return success;
+}
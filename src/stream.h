@@ -0,0 +1,114 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <future>
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <condition_variable>
+
+#include "threadpool.h"
+
+// Compression of a file, input files are detected from the magic bytes, output files from the suffix
+enum class Codec { Plain, Gzip, Zstd };
+
+Codec codecOf(const std::string& filename);
+
+/**
+ * streambuf reading a plain, gzip or zstd file. A worker thread reads and decompresses
+ * the file into chunks ahead of the reader, so I/O and decompression overlap with parsing.
+ * A read error, corrupted data or a file ending inside a gzip member or zstd frame is
+ * raised to the reader after the data decompressed before it, the stream turns bad.
+ */
+class ReadBuf : public std::streambuf {
+public:
+    ReadBuf(FILE* file, Codec codec);
+    ~ReadBuf();
+
+    std::string error();
+
+protected:
+    int_type underflow() override;
+
+private:
+    FILE* file;
+    Codec codec;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> chunks;  // decompressed data waiting for the reader
+    std::string current;             // chunk being read
+    bool done = false;
+    bool stop = false;
+    std::string failure;             // why the file could not be read to its end
+
+    void run();
+    bool emit(std::string& chunk);
+};
+
+/**
+ * streambuf writing a plain, gzip or zstd file. Data is cut into large blocks, compressed
+ * blocks are handled independently by a thread pool and written in order. gzip members
+ * and zstd frames can be concatenated, so the result is a regular compressed file.
+ */
+class WriteBuf : public std::streambuf {
+public:
+    WriteBuf(FILE* file, Codec codec, size_t threads);
+    ~WriteBuf();
+
+    bool close();
+
+protected:
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    FILE* file;
+    Codec codec;
+    ThreadPool pool;
+    size_t maxPending;
+    std::vector<char> block;
+    std::deque<std::future<std::string> > pending;  // blocks being compressed, in file order
+    bool failed = false;
+
+    void submit();
+    void writeFront();
+};
+
+/** input file stream reading plain, gzip or zstd files */
+class InputStream : public std::istream {
+public:
+    InputStream(const std::string& filename);
+    ~InputStream();
+
+    bool is_open() const { return file != nullptr; }
+    void close();
+    // why the stream turned bad, empty if the file was read without error
+    std::string error() const { return buf ? buf->error() : std::string(); }
+
+private:
+    FILE* file = nullptr;
+    std::unique_ptr<ReadBuf> buf;
+};
+
+/** output file stream writing plain, gzip (.gz) or zstd (.zst) files */
+class OutputStream : public std::ostream {
+public:
+    OutputStream(const std::string& filename, size_t threads=1, bool append=false);
+    ~OutputStream();
+
+    bool is_open() const { return file != nullptr; }
+    bool close();
+
+private:
+    FILE* file = nullptr;
+    std::unique_ptr<WriteBuf> buf;
+};
+
+#endif
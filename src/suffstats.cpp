@@ -0,0 +1,391 @@
+#include <cmath>
+#include <fstream>
+
+#include <omp.h>
+
+#include "suffstats.h"
+
+namespace {
+    using Utils::writeValue;
+    using Utils::readValue;
+    using Utils::writeString;
+    using Utils::readString;
+
+    const char MAGIC[4] = {'G', 'P', 'S', 'S'};
+    // version 1 has no sample names
+    const uint32_t VERSION = 2;
+
+    void writeNames(std::ostream& os, const std::vector<std::string>& names) {
+        writeValue<uint64_t>(os, names.size());
+        for (const std::string& name : names)
+            writeString(os, name);
+    }
+
+    bool readNames(std::istream& is, std::vector<std::string>& names) {
+        uint64_t size;
+        // every name takes at least its 4 byte length
+        if (!readValue(is, size) || size > Utils::remaining(is) / 4) return false;
+        names.clear();
+        std::string name;
+        for (uint64_t n = 0; n < size; ++n) {
+            if (!readString(is, name)) return false;
+            names.push_back(name);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Rows of the new data whose samples are not in the statistics yet
+     *
+     * @param data new samples
+     * @param known samples of the statistics, sorted
+     * @param rows
+     * @return number of samples skipped
+     */
+    size_t newRows(const DataFrame* data, const std::vector<std::string>& known, std::vector<int>& rows) {
+        rows.clear();
+        for (int r = 0; r < static_cast<int>(data->data.rows()); ++r) {
+            const std::string& name = r < static_cast<int>(data->index.size()) ? data->index[r] : "";
+            if (!std::binary_search(known.begin(), known.end(), name)) rows.push_back(r);
+        }
+        return data->data.rows() - rows.size();
+    }
+
+    MatrixXd selectRows(const MatrixXd& data, const std::vector<int>& rows) {
+        MatrixXd selected(rows.size(), data.cols());
+        for (size_t r = 0; r < rows.size(); ++r)
+            selected.row(r) = data.row(rows[r]);
+        return selected;
+    }
+
+    /**
+     * @brief Columns of the new data in the order of a dictionary
+     *
+     * @return false if a feature of the dictionary is missing
+     */
+    bool mapColumns(const std::vector<std::string>& dict, const DataFrame* data, std::vector<int>& index) {
+        std::map<std::string, int> position;
+        for (size_t c = 0; c < data->columns.size(); ++c)
+            position.insert({data->columns[c], static_cast<int>(c)});
+        index.resize(dict.size());
+        for (size_t i = 0; i < dict.size(); ++i) {
+            auto it = position.find(dict[i]);
+            if (it == position.end()) {
+                std::cerr << "[Update] - Feature " << dict[i] << " is not in the new data." << std::endl;
+                return false;
+            }
+            index[i] = it->second;
+        }
+        return true;
+    }
+}
+
+SuffStats::SuffStats() {}
+
+SuffStats::SuffStats(size_t nkeys, size_t nstats) {
+    reset(nkeys, nstats);
+}
+
+/**
+ * @brief Remove all records and define the record layout
+ *
+ * @param nkeys number of feature indices of a record
+ * @param nstats number of statistics of a record
+ */
+void SuffStats::reset(size_t nkeys, size_t nstats) {
+    nk = nkeys;
+    ns = nstats;
+    nrecords = 0;
+    keys.clear();
+    stats.clear();
+}
+
+void SuffStats::push(const uint32_t* k, const double* s) {
+    keys.insert(keys.end(), k, k + nk);
+    stats.insert(stats.end(), s, s + ns);
+    nrecords++;
+}
+
+void SuffStats::push(std::initializer_list<uint32_t> k, std::initializer_list<double> s) {
+    push(k.begin(), s.begin());
+}
+
+/**
+ * @brief Append the records of another store with the same layout
+ *
+ * @param other
+ */
+void SuffStats::append(const SuffStats& other) {
+    keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+    stats.insert(stats.end(), other.stats.begin(), other.stats.end());
+    nrecords += other.nrecords;
+}
+
+/**
+ * @brief Save the statistics to file
+ *
+ * @param filename
+ * @return true
+ * @return false
+ */
+bool SuffStats::save(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[Sufficient Statistics] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    file.write(MAGIC, sizeof(MAGIC));
+    writeValue<uint32_t>(file, VERSION);
+    writeString(file, mode);
+    writeString(file, operation);
+    writeValue<double>(file, ratio);
+    writeValue<double>(file, revRatio);
+    writeValue<double>(file, threshold);
+    writeValue<double>(file, slack);
+    writeValue<uint64_t>(file, srows);
+    writeValue<uint64_t>(file, trows);
+    writeValue<double>(file, untracked);
+    writeValue<double>(file, untrackedRev);
+    writeNames(file, sourceSamples);
+    writeNames(file, targetSamples);
+    writeValue<uint32_t>(file, ns);
+    writeValue<uint64_t>(file, nrecords);
+    layout.save(file);
+    file.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(stats.data()), stats.size() * sizeof(double));
+    return static_cast<bool>(file);
+}
+
+/**
+ * @brief Load the statistics from file
+ *
+ * @param filename
+ * @return true
+ * @return false
+ */
+bool SuffStats::load(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4];
+    uint32_t version, nstats;
+    uint64_t records;
+    bool valid = file.is_open() && file.read(magic, sizeof(magic)) && std::equal(magic, magic + 4, MAGIC) &&
+                 readValue(file, version) && (version == 1 || version == VERSION) &&
+                 readString(file, mode) && readString(file, operation) &&
+                 readValue(file, ratio) && readValue(file, revRatio) && readValue(file, threshold) && readValue(file, slack) &&
+                 readValue(file, srows) && readValue(file, trows) && readValue(file, untracked) && readValue(file, untrackedRev) &&
+                 (version == 1 || (readNames(file, sourceSamples) && readNames(file, targetSamples))) &&
+                 readValue(file, nstats) && readValue(file, records) && layout.load(file);
+    if (!valid) {
+        std::cerr << "[Sufficient Statistics] - Invalid statistics file: " << filename << std::endl;
+        return false;
+    }
+    // a damaged size is rejected instead of allocated
+    uint64_t recordBytes = layout.nkeys() * sizeof(uint32_t) + static_cast<uint64_t>(nstats) * sizeof(double);
+    size_t nkeys = mode == "pairs" ? 3 : 2;
+    size_t expected = mode == "stable" ? 1 : (mode == "reverse" ? 2 : Algorithm::PEARSON_SUMS);
+    bool known = mode == "stable" || mode == "reverse" || mode == "common" || mode == "cross" || mode == "pairs";
+    if (!known || layout.nkeys() != nkeys || nstats != expected || records > Utils::remaining(file) / recordBytes) {
+        std::cerr << "[Sufficient Statistics] - Invalid statistics file: " << filename << std::endl;
+        return false;
+    }
+    reset(layout.nkeys(), nstats);
+    nrecords = records;
+    keys.resize(nrecords * nk);
+    stats.resize(nrecords * ns);
+    file.read(reinterpret_cast<char*>(keys.data()), keys.size() * sizeof(uint32_t));
+    file.read(reinterpret_cast<char*>(stats.data()), stats.size() * sizeof(double));
+    // keys index the dictionaries of the layout
+    bool indexed = static_cast<bool>(file);
+    for (size_t c = 0; c < nk && indexed; ++c) {
+        size_t size = layout.dicts[layout.keyDict[c]].size();
+        for (size_t r = 0; r < nrecords && indexed; ++r)
+            indexed = keys[r * nk + c] < size;
+    }
+    if (!indexed) {
+        std::cerr << "[Sufficient Statistics] - Invalid statistics file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Fold new samples into the statistics, only the new rows are read. Samples already
+ *        in the statistics are skipped, the target samples of cross and pairs runs are
+ *        matched to the source samples by name.
+ *
+ * @param source new samples of the source data, nullptr if none
+ * @param target new samples of the target data, nullptr if none
+ * @param threads
+ * @return true
+ * @return false
+ */
+bool SuffStats::update(const DataFrame* source, const DataFrame* target, size_t threads) {
+    bool stable = mode == "stable" || mode == "reverse";
+    bool paired = mode == "cross" || mode == "pairs";
+    if (source == nullptr && (mode != "reverse" || target == nullptr)) {
+        std::cerr << "[Update] - New samples of the expression data are needed." << std::endl;
+        return false;
+    }
+    if (paired && target == nullptr) {
+        std::cerr << "[Update] - The new samples of the expression and target data must be the same." << std::endl;
+        return false;
+    }
+    if ((mode == "stable" || mode == "common") && target != nullptr) {
+        std::cerr << "[Update] - A " << mode << " run has no target data." << std::endl;
+        return false;
+    }
+    // key columns reading the source and the target data
+    std::vector<int> sourceKey, targetKey;
+    if (mode == "cross") {
+        sourceKey = {0};
+        targetKey = {1};
+    } else if (mode == "pairs") {
+        sourceKey = {1, 2};
+        targetKey = {0};
+    } else {
+        sourceKey = {0, 1};
+    }
+    std::vector<int> scols, tcols;
+    if (source != nullptr && !mapColumns(layout.dicts[layout.keyDict[sourceKey[0]]], source, scols)) return false;
+    if (target != nullptr) {
+        // reversed stable pairs compare the same features in the target data
+        int dict = layout.keyDict[stable ? sourceKey[0] : targetKey[0]];
+        if (!mapColumns(layout.dicts[dict], target, tcols)) return false;
+    }
+
+    // samples already in the statistics, eg. a release with the old and new samples
+    if (sourceSamples.size() != srows) sourceSamples.clear();
+    if (targetSamples.size() != trows) targetSamples.clear();
+    std::vector<std::string> known = sourceSamples, knownTarget = targetSamples;
+    std::sort(known.begin(), known.end());
+    std::sort(knownTarget.begin(), knownTarget.end());
+    if ((source != nullptr && known.empty() && srows > 0) || (mode == "reverse" && target != nullptr && knownTarget.empty() && trows > 0))
+        std::cout << "[Update] - Warning: the statistics do not record their samples, samples given again are counted twice." << std::endl;
+    std::vector<int> srowIndex, trowIndex;
+    size_t skipped = 0;
+    if (source != nullptr)
+        skipped += newRows(source, known, srowIndex);
+    if (mode == "reverse" && target != nullptr)
+        skipped += newRows(target, knownTarget, trowIndex);
+    if (paired) {
+        // the same samples in the order of the source
+        std::map<std::string, int> position;
+        for (size_t r = 0; r < target->index.size(); ++r)
+            position.insert({target->index[r], static_cast<int>(r)});
+        if (position.size() != static_cast<size_t>(target->data.rows()) || target->data.rows() != source->data.rows()) {
+            std::cerr << "[Update] - The new samples of the expression and target data must be the same." << std::endl;
+            return false;
+        }
+        for (int r : srowIndex) {
+            auto it = position.find(source->index[r]);
+            if (it == position.end()) {
+                std::cerr << "[Update] - Sample " << source->index[r] << " is not in the new target data." << std::endl;
+                return false;
+            }
+            trowIndex.push_back(it->second);
+        }
+    }
+    if (skipped > 0)
+        std::cout << "[Update] - Skip " << skipped << " samples that are already in the statistics." << std::endl;
+    MatrixXd sourceRows, targetRows;
+    if (source != nullptr)
+        sourceRows = selectRows(source->data, srowIndex);
+    if (target != nullptr && (paired || mode == "reverse"))
+        targetRows = selectRows(target->data, trowIndex);
+    const MatrixXd* S = source != nullptr ? &sourceRows : nullptr;
+    const MatrixXd* T = target != nullptr ? &targetRows : nullptr;
+    #pragma omp parallel num_threads(std::max<size_t>(threads, 1))
+    {
+        VectorXd res;
+        #pragma omp for schedule(static)
+        for (size_t r = 0; r < nrecords; ++r) {
+            const uint32_t* k = &keys[r * nk];
+            double* s = &stats[r * ns];
+            if (mode == "stable") {
+                s[0] += (S->col(scols[k[0]]).array() > S->col(scols[k[1]]).array()).count();
+            } else if (mode == "reverse") {
+                if (S != nullptr)
+                    s[0] += (S->col(scols[k[0]]).array() > S->col(scols[k[1]]).array()).count();
+                if (T != nullptr)
+                    s[1] += (T->col(tcols[k[0]]).array() < T->col(tcols[k[1]]).array()).count();
+            } else if (mode == "common") {
+                Algorithm::pearsonSums(S->col(scols[k[0]]), S->col(scols[k[1]]), s);
+            } else if (mode == "cross") {
+                Algorithm::pearsonSums(S->col(scols[k[0]]), T->col(tcols[k[1]]), s);
+            } else {
+                res = Algorithm::column_operate(*S, scols[k[1]], scols[k[2]], operation);
+                Algorithm::pearsonSums(res, T->col(tcols[k[0]]), s);
+            }
+        }
+    }
+
+    size_t newSource = S != nullptr ? S->rows() : 0;
+    size_t newTarget = T != nullptr ? T->rows() : 0;
+    srows += newSource;
+    trows += mode == "reverse" ? newTarget : (paired ? newSource : 0);
+    for (int r : srowIndex)
+        if (!sourceSamples.empty() || srows == newSource) sourceSamples.push_back(source->index[r]);
+    if (mode == "reverse") {
+        for (int r : trowIndex)
+            if (!targetSamples.empty() || trows == newTarget) targetSamples.push_back(target->index[r]);
+    }
+    std::cout << "[Update] - Folded " << std::max(newSource, newTarget) << " new samples into " << nrecords << " pairs." << std::endl;
+    if (stable) {
+        untracked += newSource;
+        untrackedRev += newTarget;
+        bool passing = untracked > std::ceil(ratio * srows);
+        if (mode == "reverse")
+            passing |= untrackedRev > std::ceil(revRatio * trows);
+        if (passing)
+            std::cout << "[Update] - Warning: pairs that were not tracked may now pass the ratio, recompute the full run." << std::endl;
+    } else {
+        std::cout << "[Update] - Pairs below cutoff - slack (" << threshold - slack << ") in the previous run are not re-evaluated." << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief Pairs passing the thresholds, with the layout of the original run
+ *
+ * @param pairs
+ */
+void SuffStats::results(PairStore& pairs) const {
+    pairs = layout.layout();
+    pairs.dicts = layout.dicts;
+    if (mode == "stable" || mode == "reverse") {
+        int lowerBound = static_cast<int>(std::ceil(ratio * srows));
+        int reverseBound = static_cast<int>(std::ceil(revRatio * trows));
+        pairs.scales[0] = PairStore::countScale(srows);
+        if (mode == "reverse")
+            pairs.scales[1] = PairStore::countScale(trows);
+        for (size_t r = 0; r < nrecords; ++r) {
+            const uint32_t* k = &keys[r * nk];
+            const double* s = &stats[r * ns];
+            int count = static_cast<int>(s[0]);
+            if (mode == "stable") {
+                if (count > lowerBound) {
+                    pairs.push({k[0], k[1]}, {pairs.encode(0, 1.0 * count / srows), 0});
+                } else if (static_cast<int>(srows) - count > lowerBound) {
+                    pairs.push({k[1], k[0]}, {pairs.encode(0, 1.0 * (srows - count) / srows), 0});
+                }
+            } else {
+                int rev = static_cast<int>(s[1]);
+                if (count > lowerBound && rev > reverseBound) {
+                    pairs.push({k[0], k[1]}, {pairs.encode(0, 1.0 * count / srows), pairs.encode(1, 1.0 * rev / trows)});
+                } else if (static_cast<int>(srows) - count > lowerBound && static_cast<int>(trows) - rev > reverseBound) {
+                    pairs.push({k[1], k[0]}, {pairs.encode(0, 1.0 * (srows - count) / srows), pairs.encode(1, 1.0 * (trows - rev) / trows)});
+                }
+            }
+        }
+    } else {
+        int bound = static_cast<int>(threshold * 1000);
+        for (size_t r = 0; r < nrecords; ++r) {
+            double corr = Algorithm::pearsonFromSums(&stats[r * ns]);
+            if (std::isnan(corr)) continue;
+            int16_t value = static_cast<int16_t>(std::round(corr * 1000));
+            if (abs(value) > bound) {
+                pairs.push(&keys[r * nk], &value);
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef SUFFSTATS_H
+#define SUFFSTATS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "utils.h"
+#include "algorithm.h"
+#include "dataframe.h"
+#include "pairstore.h"
+
+/**
+ * Sufficient statistics of the candidate pairs of a run, so that new samples can be
+ * folded in without recomputing the whole matrix. Stable pairs keep the counts of
+ * source > target (and source < target in the reversed data), pearson correlations
+ * keep the count and the sums of x, y, x^2, y^2 and xy of the complete observations.
+ *
+ * Candidates are the pairs passing the thresholds lowered by `slack`. Pairs below it
+ * are not tracked: for stable counts `untracked` bounds their count so that an update
+ * can tell when they might pass, correlations have no such bound.
+ *
+ * The names of the samples folded in are kept, an update skips the samples that are already
+ * in the statistics, so that a release with the old and new samples can be given as is.
+ *
+ * File layout (native byte order):
+ *   magic "GPSS", u32 version, mode, operation, f64 ratio, revRatio, threshold, slack,
+ *   u64 srows, trows, f64 untracked, untrackedRev,
+ *   u64 source samples, names, u64 target samples, names (version 2),
+ *   u32 nstats, u64 records,
+ *   result layout as an empty pair store (names, keys and values of the output),
+ *   keys (records * nkeys u32), stats (records * nstats f64)
+ */
+class SuffStats {
+public:
+    std::string mode;         // stable, reverse, common, cross or pairs
+    std::string operation;    // operation between the source features of pairs mode
+    double ratio = 0;
+    double revRatio = 0;
+    double threshold = 0;
+    double slack = 0;
+    uint64_t srows = 0;       // samples in the source data
+    uint64_t trows = 0;       // samples in the target data
+    double untracked = 0;     // largest possible count of an untracked pair (stable modes)
+    double untrackedRev = 0;
+    std::vector<std::string> sourceSamples;   // names of the samples folded in, empty if unknown
+    std::vector<std::string> targetSamples;   // of the target data of the reverse mode
+    PairStore layout;         // layout of the results, without records
+
+    SuffStats();
+    SuffStats(size_t nkeys, size_t nstats);
+
+    void reset(size_t nkeys, size_t nstats);
+    size_t size() const { return nrecords; }
+    size_t nkeys() const { return nk; }
+    size_t nstats() const { return ns; }
+
+    void push(const uint32_t* k, const double* s);
+    void push(std::initializer_list<uint32_t> k, std::initializer_list<double> s);
+    void append(const SuffStats& other);
+
+    bool save(const std::string& filename) const;
+    bool load(const std::string& filename);
+
+    bool update(const DataFrame* source, const DataFrame* target, size_t threads);
+    void results(PairStore& pairs) const;
+
+private:
+    size_t nk = 2;
+    size_t ns = 1;
+    size_t nrecords = 0;
+    std::vector<uint32_t> keys;
+    std::vector<double> stats;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "utils.h"
+#include "stream.h"
+#include "summary.h"
+
+namespace {
+    /**
+     * @brief Name of the feature table, `.features` is put before the extension
+     *
+     * @param filename
+     * @return file name of the feature table
+     */
+    std::string featureFile(const std::string& filename) {
+        size_t slash = filename.find_last_of('/');
+        size_t dot = filename.find('.', slash == std::string::npos ? 0 : slash + 1);
+        if (dot == std::string::npos)
+            return filename + ".features";
+        return filename.substr(0, dot) + ".features" + filename.substr(dot);
+    }
+
+    int binOf(double value) {
+        int bin = static_cast<int>(std::floor((value + 1) * Summary::BINS / 2 + 1e-9));
+        return std::min(std::max(bin, 0), Summary::BINS - 1);
+    }
+}
+
+Summary::Summary() {}
+
+/**
+ * @brief Remove the folded pairs, with a part for each thread
+ *
+ * @param threads
+ */
+void Summary::reset(size_t threads) {
+    parts.assign(std::max<size_t>(threads, 1), Part());
+}
+
+/**
+ * @brief Count a value of an evaluated pair in the histogram of its column, whether the pair
+ *        passes the cutoff or not, threads may tally at the same time
+ *
+ * @param thread
+ * @param column value column of the pairs
+ * @param value
+ */
+void Summary::tally(size_t thread, size_t column, double value) {
+    std::vector<uint64_t>& hist = parts[thread].hist;
+    if (hist.size() < (column + 1) * BINS)
+        hist.resize((column + 1) * BINS, 0);
+    hist[column * BINS + binOf(value)]++;
+}
+
+/**
+ * @brief Fold a batch of pairs passing the cutoff into the feature table of a thread, threads
+ *        may add at the same time
+ *
+ * @param batch pairs with the layout of the results
+ * @param thread
+ */
+void Summary::add(const PairStore& batch, size_t thread) {
+    Part& part = parts[thread];
+    size_t nkeys = batch.nkeys();
+    for (size_t c = 0; c < nkeys; ++c) {
+        size_t dict = batch.keyDict[c];
+        if (part.hits.size() <= dict) {
+            part.hits.resize(dict + 1);
+            part.low.resize(dict + 1);
+            part.high.resize(dict + 1);
+        }
+    }
+    for (size_t r = 0; r < batch.size(); ++r) {
+        int16_t value = batch.value(r, 0);
+        for (size_t c = 0; c < nkeys; ++c) {
+            size_t dict = batch.keyDict[c];
+            uint32_t key = batch.key(r, c);
+            std::vector<uint64_t>& hits = part.hits[dict];
+            if (hits.size() <= key) {
+                hits.resize(key + 1, 0);
+                part.low[dict].resize(key + 1, std::numeric_limits<int16_t>::max());
+                part.high[dict].resize(key + 1, std::numeric_limits<int16_t>::min());
+            }
+            hits[key]++;
+            part.low[dict][key] = std::min(part.low[dict][key], value);
+            part.high[dict][key] = std::max(part.high[dict][key], value);
+        }
+    }
+    part.pairs += batch.size();
+}
+
+/**
+ * @brief Number of pairs folded by all threads
+ *
+ * @return uint64_t
+ */
+uint64_t Summary::size() const {
+    uint64_t total = 0;
+    for (const Part& part : parts)
+        total += part.pairs;
+    return total;
+}
+
+Summary::Part Summary::merge() const {
+    Part total;
+    for (const Part& part : parts) {
+        total.pairs += part.pairs;
+        if (total.hist.size() < part.hist.size())
+            total.hist.resize(part.hist.size(), 0);
+        for (size_t b = 0; b < part.hist.size(); ++b)
+            total.hist[b] += part.hist[b];
+        if (total.hits.size() < part.hits.size()) {
+            total.hits.resize(part.hits.size());
+            total.low.resize(part.hits.size());
+            total.high.resize(part.hits.size());
+        }
+        for (size_t d = 0; d < part.hits.size(); ++d) {
+            size_t n = part.hits[d].size();
+            if (total.hits[d].size() < n) {
+                total.hits[d].resize(n, 0);
+                total.low[d].resize(n, std::numeric_limits<int16_t>::max());
+                total.high[d].resize(n, std::numeric_limits<int16_t>::min());
+            }
+            for (size_t k = 0; k < n; ++k) {
+                total.hits[d][k] += part.hits[d][k];
+                total.low[d][k] = std::min(total.low[d][k], part.low[d][k]);
+                total.high[d][k] = std::max(total.high[d][k], part.high[d][k]);
+            }
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Write the histograms and the feature table
+ *
+ * @param filename histogram file, text
+ * @param layout layout of the results with the name dictionaries
+ * @param threads compression threads
+ * @return true
+ * @return false
+ */
+bool Summary::write(const std::string& filename, const PairStore& layout, size_t threads) const {
+    Part total = merge();
+    char delim = Utils::getDelim(filename);
+    OutputStream histFile(filename, threads);
+    if (!histFile.is_open()) {
+        std::cerr << "[Summary] - Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    histFile << "value" << delim << "from" << delim << "to" << delim << "pairs" << "\n";
+    for (size_t c = 0; c < layout.nvals(); ++c) {
+        for (int b = 0; b < BINS; ++b) {
+            uint64_t count = c * BINS + b < total.hist.size() ? total.hist[c * BINS + b] : 0;
+            histFile << layout.valNames[c] << delim << -1 + 2.0 * b / BINS << delim << -1 + 2.0 * (b + 1) / BINS
+                     << delim << count << "\n";
+        }
+    }
+    if (!histFile.close()) {
+        std::cerr << "[Summary] - Failed to write file: " << filename << std::endl;
+        return false;
+    }
+
+    std::string name = featureFile(filename);
+    OutputStream featFile(name, threads);
+    if (!featFile.is_open()) {
+        std::cerr << "[Summary] - Failed to open file: " << name << std::endl;
+        return false;
+    }
+    featFile << "key" << delim << "feature" << delim << "pairs" << delim << "min" << delim << "max" << "\n";
+    std::vector<char> written(layout.dicts.size(), 0);
+    for (size_t c = 0; c < layout.nkeys(); ++c) {
+        size_t dict = layout.keyDict[c];
+        // a dictionary shared by several key columns is written once
+        if (written[dict] || dict >= total.hits.size()) continue;
+        written[dict] = 1;
+        for (size_t k = 0; k < total.hits[dict].size(); ++k) {
+            if (total.hits[dict][k] == 0) continue;
+            featFile << layout.keyNames[c] << delim << layout.dicts[dict][k] << delim << total.hits[dict][k]
+                     << delim << total.low[dict][k] / layout.scales[0] << delim << total.high[dict][k] / layout.scales[0] << "\n";
+        }
+    }
+    if (!featFile.close()) {
+        std::cerr << "[Summary] - Failed to write file: " << name << std::endl;
+        return false;
+    }
+    uint64_t evaluated = 0;
+    for (size_t b = 0; b < BINS && b < total.hist.size(); ++b)
+        evaluated += total.hist[b];
+    std::cout << "[Summary] - Wrote the distribution of " << evaluated << " evaluated pairs to " << filename
+              << " and the " << total.pairs << " pairs passing the cutoff to " << name << std::endl;
+    return true;
+}
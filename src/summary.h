@@ -0,0 +1,47 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "pairstore.h"
+
+/**
+ * Distribution of the pairs of a run without keeping them (--summary). Every thread keeps
+ * its own part: fixed-bin histograms of each value column over [-1, 1], tallied by the
+ * kernels for every pair they evaluate, and, for every feature of a key dictionary, the
+ * number of pairs passing the cutoff it is part of and their lowest and highest first value,
+ * folded from the batches of pairs. The parts are merged when the summary is written.
+ *
+ * The histograms are written to the output file (value, from, to, pairs), the features to
+ * the output with `.features` before the extension (key, feature, pairs, min, max).
+ */
+class Summary {
+public:
+    static const int BINS = 200;          // bins of width 0.01
+    static const size_t BATCH = 1 << 16;  // pairs a thread keeps before folding them
+
+    Summary();
+
+    void reset(size_t threads);
+    void tally(size_t thread, size_t column, double value);
+    void add(const PairStore& batch, size_t thread);
+    uint64_t size() const;
+
+    bool write(const std::string& filename, const PairStore& layout, size_t threads=1) const;
+
+private:
+    struct Part {
+        uint64_t pairs = 0;
+        std::vector<uint64_t> hist;                  // nvals * BINS, of all evaluated pairs
+        std::vector<std::vector<uint64_t> > hits;    // pairs of each feature, per dictionary
+        std::vector<std::vector<int16_t> > low;      // stored first value, per dictionary
+        std::vector<std::vector<int16_t> > high;
+    };
+    std::vector<Part> parts;
+
+    Part merge() const;
+};
+
+#endif
@@ -1,11 +1,15 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <mutex>
 #include <queue>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <future>
 #include <iostream>
+#include <functional>
+#include <condition_variable>
 
 
 class ThreadPool {
@@ -49,10 +53,15 @@ public:
         return res;
     }
 
+    ~ThreadPool() {
+        shutdown();
+    }
+
     // 关闭线程池
     void shutdown() {
         {
             std::unique_lock<std::mutex> lock(queueMutex);
+            if (stop) return;
             stop = true;
         }
         condition.notify_all();
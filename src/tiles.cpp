@@ -0,0 +1,180 @@
+#include <algorithm>
+
+#include "utils.h"
+#include "tiles.h"
+
+/**
+ * @brief Tiles of a run in the order they are streamed through memory
+ *
+ * @param featureIndex selected features, sorted
+ * @param selected
+ * @param ncols
+ * @param width columns of a block
+ * @param partners pair the feature blocks with blocks of partners, otherwise one tile per feature block
+ * @return tiles
+ */
+std::vector<ColumnTile> columnTiles(const std::vector<int>& featureIndex, const std::vector<char>& selected,
+                                    int ncols, int width, bool partners) {
+    std::vector<ColumnTile> tiles;
+    width = std::max(1, std::min(width, ncols));
+    int nblocks = ncols > 0 ? (ncols + width - 1) / width : 0;
+    bool forward = true;
+    for (int bi = 0; bi < nblocks; ++bi) {
+        int b0 = bi * width, b1 = std::min(b0 + width, ncols);
+        int f0 = std::lower_bound(featureIndex.begin(), featureIndex.end(), b0) - featureIndex.begin();
+        int f1 = std::lower_bound(featureIndex.begin(), featureIndex.end(), b1) - featureIndex.begin();
+        if (f0 == f1) continue;
+        if (!partners) {
+            tiles.push_back({f0, f1, b0, b1, 0, 0});
+            continue;
+        }
+        for (int step = 0; step < nblocks; ++step) {
+            int bj = forward ? step : nblocks - 1 - step;
+            int j0 = bj * width, j1 = std::min(j0 + width, ncols);
+            // partners before the block that are all selected were paired from their own block
+            if (j1 <= b0 && std::all_of(selected.begin() + j0, selected.begin() + j1, [](char s) { return s != 0; }))
+                continue;
+            tiles.push_back({f0, f1, b0, b1, j0, j1});
+        }
+        forward = !forward;
+    }
+    return tiles;
+}
+
+/**
+ * @brief Columns of a block so that a feature block and a partner block fit in the memory limit
+ *
+ * @param memoryLimit bytes, 0 for no limit
+ * @param columnBytes bytes of one column (of all the matrices streamed together)
+ * @param ncols
+ * @return width
+ */
+int tileWidth(size_t memoryLimit, size_t columnBytes, int ncols) {
+    if (memoryLimit == 0 || columnBytes == 0) return ncols;
+    size_t width = memoryLimit / (2 * columnBytes);
+    return static_cast<int>(std::max<size_t>(1, std::min<size_t>(width, ncols)));
+}
+
+/**
+ * @brief Drop the blocks of the previous tile that the tile doesn't use and prefetch its blocks
+ *
+ * @param data mapped matrix, nothing is done for data in memory
+ * @param previous nullptr for the first tile
+ * @param tile
+ */
+void pageTile(const DataFrame* data, const ColumnTile* previous, const ColumnTile& tile) {
+    if (data == nullptr || !data->is_mapped()) return;
+    auto used = [&](int c0) { return c0 == tile.b0 || c0 == tile.j0; };
+    if (previous != nullptr) {
+        if (!used(previous->b0))
+            data->release(previous->b0, previous->b1 - previous->b0);
+        if (previous->j1 > previous->j0 && previous->j0 != previous->b0 && !used(previous->j0))
+            data->release(previous->j0, previous->j1 - previous->j0);
+    }
+    data->prefetch(tile.b0, tile.b1 - tile.b0);
+    if (tile.j0 != tile.b0)
+        data->prefetch(tile.j0, tile.j1 - tile.j0);
+}
+
+/**
+ * @brief Keep a data file on disk, text files are converted to a binary matrix next to them or in
+ *        the cache directory, again when the text file changed, sparse Matrix Market files are
+ *        loaded in memory
+ *
+ * @param filename
+ * @param memoryLimit bytes used to convert a text file
+ * @param cacheDir directory of the binary matrices, empty for next to the text files
+ * @return the mapped data, nullptr on failure
+ */
+DataFrame* mapData(const std::string& filename, size_t memoryLimit, const std::string& cacheDir) {
+    if (Utils::endsWith(filename, ".mtx") || Utils::endsWith(filename, ".mtx.gz")) {
+        std::cout << "Sparse data is loaded in memory: " << filename << std::endl;
+        return new DataFrame(filename);
+    }
+    std::string binary = filename;
+    DataFrame* data = new DataFrame();
+    if (!Utils::endsWith(filename, ".gpm")) {
+        binary = cacheDir.empty() ? filename + ".gpm" : Utils::joinpath(cacheDir, Utils::basename(filename) + ".gpm");
+        if (DataFrame::converted_from(binary, filename)) {
+            std::cout << "Reuse the binary matrix " << binary << std::endl;
+        } else {
+            if (Utils::exists(binary))
+                std::cout << "The binary matrix " << binary << " is out of date, convert the data again." << std::endl;
+            if ((!cacheDir.empty() && !Utils::isdir(cacheDir) && !Utils::makedir(cacheDir)) ||
+                !data->convert_binary(filename, binary, memoryLimit)) {
+                std::cerr << "Error: could not convert " << filename << " to a binary matrix in " << Utils::dirname(binary) << std::endl;
+                delete data;
+                return nullptr;
+            }
+        }
+    }
+    if (!data->map_binary(binary)) {
+        delete data;
+        return nullptr;
+    }
+    return data;
+}
+
+/**
+ * @brief Forget the pairs of a previous loop
+ *
+ * @param threads
+ * @param chunkSize iterations of a chunk of the static schedule
+ */
+void TileOrder::reset(size_t threads, size_t chunkSize) {
+    chunk = std::max<size_t>(chunkSize, 1);
+    segments.assign(std::max<size_t>(threads, 1), std::vector<Segment>());
+    stores.assign(segments.size(), PairStore());
+}
+
+/**
+ * @brief Note that the next pair of a thread is found at an iteration of a tile loop
+ *
+ * @param thread
+ * @param tile
+ * @param iteration iteration of the collapsed loop of the tile
+ * @param record number of pairs the thread found before it
+ */
+void TileOrder::mark(size_t thread, size_t tile, uint64_t iteration, size_t record) {
+    std::vector<Segment>& own = segments[thread];
+    uint64_t c = iteration / chunk;
+    if (own.empty() || own.back().tile != tile || own.back().chunk != c)
+        own.push_back({tile, c, thread, record, record});
+}
+
+/**
+ * @brief Keep the pairs of a thread at the end of the loop, `local` is left empty
+ *
+ * @param thread
+ * @param local
+ */
+void TileOrder::keep(size_t thread, PairStore& local) {
+    stores[thread] = local.layout();
+    std::swap(stores[thread], local);
+}
+
+/**
+ * @brief Append the pairs of all threads in the order of the loop
+ *
+ * @param pairs
+ */
+void TileOrder::concat(PairStore& pairs) {
+    std::vector<Segment> all;
+    size_t total = 0;
+    for (size_t t = 0; t < segments.size(); ++t) {
+        // a segment ends where the next one of its thread begins
+        for (size_t k = 0; k < segments[t].size(); ++k)
+            segments[t][k].end = k + 1 < segments[t].size() ? segments[t][k + 1].begin : stores[t].size();
+        all.insert(all.end(), segments[t].begin(), segments[t].end());
+        total += stores[t].size();
+    }
+    // chunks are run by a single thread, (tile, chunk) identifies a segment
+    std::sort(all.begin(), all.end(), [](const Segment& a, const Segment& b) {
+        return a.tile != b.tile ? a.tile < b.tile : a.chunk < b.chunk;
+    });
+    pairs.reserve(pairs.size() + total);
+    for (const Segment& s : all)
+        pairs.append(stores[s.thread], s.begin, s.end);
+    segments.assign(segments.size(), std::vector<Segment>());
+    stores.assign(stores.size(), PairStore());
+}
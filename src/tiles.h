@@ -0,0 +1,56 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <string>
+#include <vector>
+
+#include "dataframe.h"
+#include "pairstore.h"
+
+/**
+ * Column blocks of an out-of-core run (--memory-limit). The selected features are cut into
+ * blocks of `width` columns and each block is paired with the blocks of their partners, back
+ * and forth so that the last partner block of a pass is the first one of the next pass and
+ * is not read again. Tiles whose pairs were all enumerated from an earlier block are left
+ * out. With a width of all the columns there is a single tile over the whole matrix.
+ */
+struct ColumnTile {
+    int f0, f1;   // selected features (positions in featureIndex) of the feature block
+    int b0, b1;   // columns of the feature block
+    int j0, j1;   // columns of the partner block
+};
+
+std::vector<ColumnTile> columnTiles(const std::vector<int>& featureIndex, const std::vector<char>& selected,
+                                    int ncols, int width, bool partners=true);
+/**
+ * Order of the pairs found by the threads of a tiled loop. The loop of a tile is scheduled
+ * statically in chunks of `chunk` iterations; each thread keeps its pairs and notes where
+ * the pairs of every chunk begin, and the segments are concatenated by tile and chunk.
+ * The result is the order of a sequential loop whatever the number of threads, without
+ * sorting the pairs.
+ */
+class TileOrder {
+public:
+    void reset(size_t threads, size_t chunk);
+    void mark(size_t thread, size_t tile, uint64_t iteration, size_t record);
+    void keep(size_t thread, PairStore& local);
+    void concat(PairStore& pairs);
+
+private:
+    struct Segment {
+        size_t tile;
+        uint64_t chunk;
+        size_t thread;
+        size_t begin;   // records [begin, end) in the store of the thread
+        size_t end;
+    };
+    size_t chunk = 1;
+    std::vector<std::vector<Segment> > segments;   // of each thread, in loop order
+    std::vector<PairStore> stores;                 // pairs of each thread
+};
+
+int tileWidth(size_t memoryLimit, size_t columnBytes, int ncols);
+void pageTile(const DataFrame* data, const ColumnTile* previous, const ColumnTile& tile);
+DataFrame* mapData(const std::string& filename, size_t memoryLimit, const std::string& cacheDir="");
+
+#endif
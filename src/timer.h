@@ -2,6 +2,7 @@
 #define TIMER_H
 
 #include <chrono>
+#include <cstdint>
 #include <string>
 #include <sstream>
 
@@ -21,6 +22,13 @@ class Timer{
             return std::chrono::duration_cast<second_>(clock_::now() - beg_).count(); 
         }
 
+        /** calculate elapsed time from the beginning at the resolution of the clock
+         * @return nanoseconds elapsed from the beginning
+         */
+        int64_t nanoseconds() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_::now() - beg_).count();
+        }
+
         /** output time elapsed to ostream
          * @param os reference of ostream
          * @param t reference of Timer
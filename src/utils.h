@@ -9,6 +9,8 @@
 
 #include <map>
 #include <ctime>
+#include <cstdint>
+#include <limits>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -75,12 +77,17 @@ namespace Utils{
     }
 
     /**
-     * @brief Get the delim char
+     * @brief Get the delim char, the compression suffix (.gz/.zst) is ignored
      * 
      * @param filename 
      * @return char 
      */
-    inline char getDelim(const std::string& filename) {
+    inline char getDelim(std::string filename) {
+        for (const std::string suffix : {".gz", ".zst"}) {
+            if (endsWith(filename, suffix)) {
+                filename = filename.substr(0, filename.size() - suffix.size());
+            }
+        }
         if (endsWith(filename, "csv")) {
             return ',';
         } else if (endsWith(filename, "txt") || 
@@ -507,6 +514,107 @@ namespace Utils{
         std::transform(str.begin(), str.end(), str.begin(), (int (*)(int))std::tolower);
     }
 
+    /** write the bytes of a value to a binary stream
+     * @param os output stream
+     * @param value value to be written
+     */
+    template <typename T>
+    inline void writeValue(std::ostream& os, const T& value){
+        os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    /** read the bytes of a value from a binary stream
+     * @param is input stream
+     * @param value value to be read
+     * @return true if the value was read
+     */
+    template <typename T>
+    inline bool readValue(std::istream& is, T& value){
+        return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    /** bytes left in a binary stream, to check the sizes read from a file before allocating
+     * @param is input stream
+     * @return bytes after the read position, the largest value if the stream can't seek
+     */
+    inline uint64_t remaining(std::istream& is){
+        std::streampos pos = is.tellg();
+        if(pos < 0) return std::numeric_limits<uint64_t>::max();
+        is.seekg(0, std::ios::end);
+        std::streampos end = is.tellg();
+        is.seekg(pos);
+        if(end < 0) return std::numeric_limits<uint64_t>::max();
+        return end > pos ? static_cast<uint64_t>(end - pos) : 0;
+    }
+
+    /** write a string to a binary stream as its 32-bit length and bytes
+     * @param os output stream
+     * @param str string to be written
+     */
+    inline void writeString(std::ostream& os, const std::string& str){
+        writeValue<uint32_t>(os, str.size());
+        os.write(str.data(), str.size());
+    }
+
+    /** read a string written by writeString
+     * @param is input stream
+     * @param str string to be read
+     * @return true if the string was read
+     */
+    inline bool readString(std::istream& is, std::string& str){
+        uint32_t length;
+        if(!readValue(is, length)) return false;
+        // names and labels, a longer string is a damaged file
+        if(length > (1u << 20)){
+            is.setstate(std::ios::failbit);
+            return false;
+        }
+        str.resize(length);
+        return static_cast<bool>(is.read(&str[0], length));
+    }
+
+    /** read a list of names, one per line, only the first field of a line is used
+     * @param path file path of the list
+     * @return names in the order of the file
+     */
+    inline std::vector<std::string> readList(const std::string& path){
+        std::vector<std::string> names;
+        std::ifstream fr(path);
+        std::string line;
+        while(std::getline(fr, line)){
+            line = Utils::strip(line);
+            if(line.empty()) continue;
+            names.push_back(line.substr(0, line.find_first_of("\t ,")));
+        }
+        return names;
+    }
+
+    /** positions of some names in a list of names
+     * @param names list of names
+     * @param selected names to look for
+     * @param missing number of selected names that are not in the list
+     * @return positions in increasing order without duplicates
+     */
+    inline std::vector<int> indexOf(const std::vector<std::string>& names, const std::vector<std::string>& selected, int& missing){
+        std::map<std::string, int> position;
+        for(size_t i = 0; i < names.size(); ++i){
+            position.insert({names[i], static_cast<int>(i)});
+        }
+        std::vector<int> index;
+        missing = 0;
+        for(const auto& name : selected){
+            auto it = position.find(name);
+            if(it == position.end()){
+                missing++;
+            }else{
+                index.push_back(it->second);
+            }
+        }
+        std::sort(index.begin(), index.end());
+        index.erase(std::unique(index.begin(), index.end()), index.end());
+        return index;
+    }
+
     /** get current time
      * @return year-mm-dd hh-mm-ss of current time
      */